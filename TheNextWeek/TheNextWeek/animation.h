@@ -0,0 +1,269 @@
+//
+//  animation.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "image_writer.h"
+#include "scene_file.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Animation file: one statement per line, '#' starts a comment. Times are seconds from the start of the sequence.
+//   frames <n>
+//   fps <rate>
+//   shutter <fraction>                 part of the frame interval the shutter is open (0.5 = 180 degrees, 0 = none)
+//   sphere <index> <time> x y z        keyframe for the center of sphere <index> of the scene
+//   lookfrom <time> x y z              camera keyframes
+//   lookat <time> x y z
+// Positions between keyframes are linear, and hold still before the first and after the last one.
+
+struct keyframe {
+    double time;
+    point3 value;
+};
+
+class keyframe_track {
+public:
+    void add(double time, const point3& value) {
+        // Keeps the keys sorted by time; a key at the same time as an earlier one replaces it.
+        auto at_or_after = std::lower_bound(keys.begin(), keys.end(), time,
+                                            [](const keyframe& k, double t) { return k.time < t; });
+        if (at_or_after != keys.end() && at_or_after->time == time)
+            at_or_after->value = value;
+        else
+            keys.insert(at_or_after, keyframe{time, value});
+    }
+
+    bool empty() const { return keys.empty(); }
+
+    point3 at(double time) const {
+        if (time <= keys.front().time)
+            return keys.front().value;
+        if (time >= keys.back().time)
+            return keys.back().value;
+        auto after = std::upper_bound(keys.begin(), keys.end(), time,
+                                      [](double t, const keyframe& k) { return t < k.time; });
+        const auto& a = *(after - 1);
+        const auto& b = *after;
+        double s = (time - a.time) / (b.time - a.time);
+        return a.value + s * (b.value - a.value);
+    }
+
+private:
+    std::vector<keyframe> keys;
+};
+
+class animation {
+public:
+    int    frames  = 0;
+    double fps     = 24;
+    double shutter = 0.5;
+
+    std::map<size_t, keyframe_track> spheres;   // keyed by the sphere's index in scene_data::spheres
+    keyframe_track lookfrom, lookat;
+
+    bool load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            std::clog << "Cannot open animation file " << path << ".\n";
+            return false;
+        }
+        int line_number = 0;
+        for (std::string line; std::getline(file, line); ) {
+            line_number++;
+            line = line.substr(0, line.find('#'));
+            std::istringstream in(line);
+            std::string statement;
+            if (!(in >> statement))
+                continue;
+
+            bool ok = true;
+            double time, x, y, z;
+            if (statement == "frames")
+                ok = static_cast<bool>(in >> frames);
+            else if (statement == "fps")
+                ok = static_cast<bool>(in >> fps) && fps > 0;
+            else if (statement == "shutter")
+                ok = static_cast<bool>(in >> shutter) && shutter >= 0 && shutter <= 1;
+            else if (statement == "sphere") {
+                size_t index;
+                ok = static_cast<bool>(in >> index >> time >> x >> y >> z);
+                if (ok)
+                    spheres[index].add(time, point3(x, y, z));
+            } else if (statement == "lookfrom" || statement == "lookat") {
+                ok = static_cast<bool>(in >> time >> x >> y >> z);
+                if (ok)
+                    (statement == "lookfrom" ? lookfrom : lookat).add(time, point3(x, y, z));
+            } else
+                ok = false;
+
+            if (!ok) {
+                std::clog << path << ':' << line_number << ": cannot read \"" << line << "\".\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void bounce(const scene_data& scene, double period = 1) {
+        // The built-in animation: every sphere that has a motion vector bounces along it, up and back once per period.
+        double length = frames / fps;
+        int half_periods = static_cast<int>(std::ceil(2 * length / period));
+        for (size_t i = 0; i < scene.spheres.size(); ++i) {
+            const auto& s = scene.spheres[i];
+            if (s.motion.near_zero())
+                continue;
+            for (int k = 0; k <= half_periods; ++k)
+                spheres[i].add(k * period / 2, (k % 2) ? s.center + s.motion : s.center);
+        }
+    }
+
+    double shutter_open(int frame) const { return frame / fps; }
+    double shutter_close(int frame) const { return (frame + shutter) / fps; }
+
+    scene_data frame_scene(const scene_data& scene, int frame) const {
+        // The scene while frame's shutter is open. An animated sphere starts where it is when the shutter opens and
+        // moves in a straight line to where it is when it closes, so the ray times [0,1) span the shutter window.
+        // Spheres without keyframes keep the scene's own motion.
+        scene_data result = scene;
+        double open = shutter_open(frame), close = shutter_close(frame);
+        for (const auto& track : spheres) {
+            if (track.first >= result.spheres.size())
+                continue;
+            auto& s = result.spheres[track.first];
+            s.center = track.second.at(open);
+            s.motion = track.second.at(close) - s.center;
+        }
+        result.nodes.clear();
+        return result;
+    }
+
+    void frame_camera(camera& cam, int frame) const {
+        if (!lookfrom.empty())
+            cam.lookfrom = lookfrom.at(shutter_open(frame));
+        if (!lookat.empty())
+            cam.lookat = lookat.at(shutter_open(frame));
+    }
+};
+
+inline std::string frame_path(const std::string& pattern, int frame) {
+    // "frame_%04d.png" (printf style, %d with an optional zero-padded width) gets the frame number.
+    // A path without one gets it before the extension: "out.png" -> "out_0007.png".
+    auto number = [frame](size_t width) {
+        auto digits = std::to_string(frame);
+        if (digits.size() < width)
+            digits.insert(0, width - digits.size(), '0');
+        return digits;
+    };
+    auto percent = pattern.find('%');
+    if (percent != std::string::npos) {
+        auto end = percent + 1;
+        size_t width = 0;
+        while (end < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[end])))
+            width = width * 10 + (pattern[end++] - '0');
+        if (end < pattern.size() && pattern[end] == 'd')
+            return pattern.substr(0, percent) + number(width) + pattern.substr(end + 1);
+    }
+    auto dot = pattern.rfind('.');
+    auto slash = pattern.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = pattern.size();
+    return pattern.substr(0, dot) + "_" + number(4) + pattern.substr(dot);
+}
+
+inline bool render_sequence(camera cam, const scene_data& scene, const animation& anim) {
+    // Renders every frame of anim over scene, with the camera's settings and output path as the frame pattern.
+    // Frame n+1's scene and bvh_node are built on a background thread while frame n renders, and frame n's PNG is
+    // encoded by a shared image_writer while frame n+1 renders, so between frames the render threads only wait
+    // for whichever of the two is slower than a frame.
+    if (anim.frames <= 0) {
+        std::clog << "The animation has no frames.\n";
+        return false;
+    }
+
+    struct frame_world {
+        shared_ptr<hittable> world;
+        bool moving;
+        double build_seconds;
+    };
+    auto build = [&](int frame) {
+        return std::async(std::launch::async, [&scene, &anim, frame] {
+            auto start = std::chrono::steady_clock::now();
+            auto frame_scene = anim.frame_scene(scene, frame);
+            frame_world result;
+            result.moving = frame_scene.has_motion();
+            result.world = make_shared<bvh_node>(frame_scene.build_world());
+            result.build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return result;
+        });
+    };
+
+    int encoders = cam.encode_threads > 0 ? cam.encode_threads : static_cast<int>(std::thread::hardware_concurrency());
+    auto writer = make_shared<image_writer>(encoders);
+    cam.share_writer(writer);
+    auto png_pattern = cam.output_path;
+    auto pfm_pattern = cam.hdr_path;
+
+    auto seconds_since = [](std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    };
+    auto start = std::chrono::steady_clock::now();
+    double build_seconds = 0, waited_seconds = 0, render_seconds = 0;
+
+    auto next = build(0);
+    for (int frame = 0; frame < anim.frames; ++frame) {
+        auto wait_start = std::chrono::steady_clock::now();
+        auto current = next.get();
+        if (frame > 0)
+            waited_seconds += seconds_since(wait_start);    // frame 0's build has nothing to hide behind
+        build_seconds += current.build_seconds;
+        if (frame + 1 < anim.frames)
+            next = build(frame + 1);
+
+        cam.output_path = frame_path(png_pattern, frame);
+        if (!pfm_pattern.empty())
+            cam.hdr_path = frame_path(pfm_pattern, frame);
+        cam.motion_blur = current.moving;
+        anim.frame_camera(cam, frame);
+
+        std::clog << "Frame " << frame + 1 << " of " << anim.frames << ": " << cam.output_path << '\n';
+        auto render_start = std::chrono::steady_clock::now();
+        cam.render(*current.world);
+        render_seconds += seconds_since(render_start);
+    }
+
+    auto drain_start = std::chrono::steady_clock::now();
+    writer->drain();
+    std::clog << anim.frames << " frames in " << seconds_since(start) << " s: rendering " << render_seconds
+              << " s, scene builds " << build_seconds << " s (render threads waited " << waited_seconds
+              << " s for them), last PNGs " << seconds_since(drain_start) << " s.\n";
+    return true;
+}
+
+#endif /* ANIMATION_H */
+
+// Note
+// 프레임마다 scene과 BVH를 새로 만들지만, 다음 프레임 것은 현재 프레임이 렌더링되는 동안 background thread에서 만들어짐.
+// Shutter window [open, close]가 ray time [0,1)에 대응하므로, 한 프레임 안의 움직임은 기존 moving sphere의 직선 운동으로 표현됨.
+// bvh_node picks its split axes with random_int: each frame is built on a fresh thread, so it gets the same tree on every run.
@@ -0,0 +1,173 @@
+//
+//  arena.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "rtweekend.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+class arena {
+public:
+    // Monotonic allocator: allocation bumps a pointer inside the current block, and memory only comes back
+    // all at once in release(). Objects created here are never destroyed one by one, so they must not own
+    // anything outside the arena (use arena::borrow for pointers between arena objects). Not thread-safe.
+
+    explicit arena(size_t block_bytes = size_t(2) << 20, bool use_huge_pages = false)
+        : block_size(block_bytes), huge_pages(use_huge_pages) {}
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena() { release(); }
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        auto aligned = (cursor + (alignment - 1)) & ~(uintptr_t(alignment) - 1);
+        if (!cursor || aligned + size > limit) {
+            add_block(size + alignment);
+            aligned = (cursor + (alignment - 1)) & ~(uintptr_t(alignment) - 1);
+        }
+        cursor = aligned + size;
+        used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static shared_ptr<T> borrow(T* object) {
+        // A shared_ptr with no control block: copies never touch a reference count, and dropping the last
+        // copy frees nothing. The arena that created the object is its only owner.
+        return shared_ptr<T>(shared_ptr<T>(), object);
+    }
+
+    void release() {
+        // One munmap/free per block, no matter how many objects were placed in it.
+        for (auto& b : blocks) {
+            if (b.mapped)
+                munmap(b.base, b.size);
+            else
+                std::free(b.base);
+        }
+        blocks.clear();
+        cursor = limit = 0;
+        used = reserved = 0;
+    }
+
+    size_t bytes_used() const { return used; }
+    size_t bytes_reserved() const { return reserved; }
+
+private:
+    struct block {
+        void* base;
+        size_t size;
+        bool mapped;
+    };
+
+    size_t block_size;
+    bool huge_pages;
+    std::vector<block> blocks;
+    uintptr_t cursor = 0, limit = 0;
+    size_t used = 0, reserved = 0;
+
+    void add_block(size_t min_size) {
+        size_t size = block_size > min_size ? block_size : min_size;
+        block b = { nullptr, size, false };
+
+        if (huge_pages) {
+            // Round to whole 2 MB pages and ask for transparent huge pages, which cuts TLB misses when
+            // traversal hops between nodes. mmap only promises 4 KB alignment, and a huge page can only back a
+            // 2 MB-aligned range, so map one huge page more and unmap the unaligned head and tail.
+            // Falls back to the regular heap if the mapping fails.
+            const size_t huge_page = size_t(2) << 20;
+            b.size = (size + huge_page - 1) & ~(huge_page - 1);
+            void* p = mmap(nullptr, b.size + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED) {
+                auto start = reinterpret_cast<uintptr_t>(p);
+                auto aligned = (start + huge_page - 1) & ~uintptr_t(huge_page - 1);
+                if (aligned > start)
+                    munmap(p, aligned - start);
+                munmap(reinterpret_cast<void*>(aligned + b.size), start + huge_page - aligned);
+                p = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+                madvise(p, b.size, MADV_HUGEPAGE);
+#endif
+                b.base = p;
+                b.mapped = true;
+            } else {
+                b.size = size;
+            }
+        }
+        if (!b.base) {
+            b.base = std::malloc(b.size);
+            if (!b.base)
+                throw std::bad_alloc();
+        }
+
+        blocks.push_back(b);
+        cursor = reinterpret_cast<uintptr_t>(b.base);
+        limit = cursor + b.size;
+        reserved += b.size;
+    }
+};
+
+class scene_arena {
+public:
+    // One arena per kind of scene object, so primitives, materials and BVH nodes each end up contiguous
+    // and a traversal step walks through memory that holds nothing but nodes.
+    arena primitives;
+    arena materials;
+    arena nodes;
+
+    explicit scene_arena(bool use_huge_pages = false)
+        : primitives(size_t(2) << 20, use_huge_pages),
+          materials(size_t(2) << 20, use_huge_pages),
+          nodes(size_t(2) << 20, use_huge_pages) {}
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make_primitive(Args&&... args) {
+        return arena::borrow(primitives.create<T>(std::forward<Args>(args)...));
+    }
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make_material(Args&&... args) {
+        return arena::borrow(materials.create<T>(std::forward<Args>(args)...));
+    }
+
+    template <typename T, typename... Args>
+    shared_ptr<T> make_node(Args&&... args) {
+        return arena::borrow(nodes.create<T>(std::forward<Args>(args)...));
+    }
+
+    size_t bytes_used() const {
+        return primitives.bytes_used() + materials.bytes_used() + nodes.bytes_used();
+    }
+
+    void release() {
+        primitives.release();
+        materials.release();
+        nodes.release();
+    }
+};
+
+#endif /* ARENA_H */
+
+// Note
+// make_shared는 object마다 control block과 atomic refcount를 따로 가지고, 종료 시에도 하나씩 해제됨.
+// arena에 만든 object는 control block 없이 borrow된 shared_ptr로만 참조되기 때문에 복사해도 refcount가 바뀌지 않고,
+// the whole scene is freed with one call per block when the arena goes away.
@@ -0,0 +1,518 @@
+//
+//  bench.cpp
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "compressed_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_set.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Allocator that only counts, so allocate_shared reports what make_shared really costs per object
+// (object + control block), which sizeof(sphere) alone doesn't show.
+static size_t counted_bytes = 0;
+
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+
+    counting_allocator() {}
+    template <typename U> counting_allocator(const counting_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        counted_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+};
+
+template <typename T, typename U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const counting_allocator<T>&, const counting_allocator<U>&) { return false; }
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct kernel_result {
+    std::string name;
+    std::string unit;       // what one operation is: ray, test, scatter, sample, number
+    size_t ops;             // operations per timed batch
+    double min_ns, median_ns, mean_ns, stddev_ns;   // per operation, over the batches
+    double checksum;        // of one batch
+    bool consistent;        // every batch returned the same checksum
+};
+
+class kernel_suite {
+public:
+    // Microbenchmarks of single kernels: each one runs an untimed warm-up batch, then `repetitions` timed
+    // batches of the same operations, and is reported by the spread of its ns per operation over the batches.
+    // A batch returns a checksum of what it computed. Every batch starts from the same random state, so all of
+    // them must return the same checksum; it is reported, so a kernel whose results change shows up next to its
+    // timing, and a batch that disagrees is flagged. Comparing it also keeps the work from being optimized away.
+    int repetitions = 10;
+    std::string filter;     // only kernels whose name contains it
+
+    bool wants(const std::string& name) const { return filter.empty() || name.find(filter) != std::string::npos; }
+
+    template <typename batch_function>
+    void run(const std::string& name, const char* unit, size_t ops, batch_function batch) {
+        if (!wants(name))
+            return;
+        kernel_result result;
+        result.name = name;
+        result.unit = unit;
+        result.ops = ops;
+        seed_random(batch_seed);
+        result.checksum = batch();
+        result.consistent = true;
+
+        std::vector<double> ns;
+        for (int k = 0; k < std::max(repetitions, 1); k++) {
+            seed_random(batch_seed);
+            auto start = std::chrono::steady_clock::now();
+            double checksum = batch();
+            ns.push_back(seconds_since(start) * 1e9 / ops);
+            result.consistent = result.consistent && checksum == result.checksum;
+        }
+        std::sort(ns.begin(), ns.end());
+        double sum = 0, sum_sq = 0;
+        for (double x : ns) {
+            sum += x;
+            sum_sq += x * x;
+        }
+        size_t n = ns.size();
+        result.min_ns = ns.front();
+        result.median_ns = n % 2 ? ns[n / 2] : (ns[n / 2 - 1] + ns[n / 2]) / 2;
+        result.mean_ns = sum / n;
+        result.stddev_ns = n > 1 ? std::sqrt(std::max(0.0, (sum_sq - sum * sum / n) / (n - 1))) : 0.0;
+
+        std::printf("  %-34s %9.2f ns/%-7s %9.2f M%ss/s   min %8.2f  sd %5.1f%%  checksum %.6g%s\n", name.c_str(),
+                    result.median_ns, unit, 1e3 / result.median_ns, unit, result.min_ns,
+                    100 * result.stddev_ns / result.mean_ns, result.checksum, result.consistent ? "" : " (varies!)");
+        results.push_back(result);
+    }
+
+    bool write_json(const std::string& path) const {
+        FILE* f = std::fopen(path.c_str(), "w");
+        if (!f) {
+            std::fprintf(stderr, "Cannot write %s.\n", path.c_str());
+            return false;
+        }
+        std::fprintf(f, "{\n  \"repetitions\": %d,\n  \"kernels\": [\n", std::max(repetitions, 1));
+        for (size_t k = 0; k < results.size(); k++) {
+            const auto& r = results[k];
+            std::fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %zu, "
+                            "\"ns_per_op\": {\"min\": %.4f, \"median\": %.4f, \"mean\": %.4f, \"stddev\": %.4f}, "
+                            "\"ops_per_second\": %.1f, \"checksum\": %.17g, \"checksum_consistent\": %s}%s\n",
+                         r.name.c_str(), r.unit.c_str(), r.ops, r.min_ns, r.median_ns, r.mean_ns, r.stddev_ns,
+                         1e9 / r.median_ns, r.checksum, r.consistent ? "true" : "false", k + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(f, "  ]\n}\n");
+        return std::fclose(f) == 0;
+    }
+
+private:
+    static const uint64_t batch_seed = 0x5eed;
+    std::vector<kernel_result> results;
+};
+
+static std::vector<ray> rays_toward(double distance, double extent, size_t count) {
+    // Rays from a sphere of radius `distance` around the origin toward random points of the cube [-extent, extent]^3,
+    // at random times (moving spheres care).
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (size_t k = 0; k < count; k++) {
+        auto origin = distance * random_unit_vector();
+        rays.push_back(ray(origin, vec3::random(-extent, extent) - origin, random_double()));
+    }
+    return rays;
+}
+
+template <typename world_type>
+static double count_hits(const world_type& world, const std::vector<ray>& rays) {
+    hit_record rec;
+    double hits = 0;
+    for (const auto& r : rays)
+        if (world.hit(r, interval(0.001, infinity), rec))
+            hits += rec.t;
+    return hits;
+}
+
+static void bench_kernels(kernel_suite& suite) {
+    // Names are what --filter matches. Intersection kernels are called through their concrete type, so for
+    // sphere::hit and aabb::hit the numbers are the math itself; bvh_node and hittable_list make their usual
+    // virtual calls to the children.
+    std::printf("kernels (median of %d batches)\n", std::max(suite.repetitions, 1));
+    // Each scene and ray set is made from its own fixed seed, so checksums don't depend on which kernels ran.
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    seed_random(1);
+    auto unit_rays = rays_toward(5, 1.5, 1 << 16);     // about half of them hit a unit sphere at the origin
+
+    sphere stationary(point3(0,0,0), 1.0, mat);
+    sphere moving(point3(0,-0.25,0), point3(0,0.25,0), 1.0, mat);
+    suite.run("sphere::hit stationary", "ray", unit_rays.size(), [&] { return count_hits(stationary, unit_rays); });
+    suite.run("sphere::hit moving", "ray", unit_rays.size(), [&] { return count_hits(moving, unit_rays); });
+
+    aabb box(point3(-1,-1,-1), point3(1,1,1));
+    suite.run("aabb::hit", "test", unit_rays.size(), [&] {
+        double hits = 0;
+        for (const auto& r : unit_rays)
+            hits += box.hit(r, interval(0.001, infinity));
+        return hits;
+    });
+
+    hittable_list small_list;
+    for (int k = 0; k < 64; k++)
+        small_list.add(make_shared<sphere>(vec3::random(-1.5, 1.5), random_double(0.05, 0.2), mat));
+    suite.run("hittable_list::hit 64 spheres", "ray", unit_rays.size(), [&] { return count_hits(small_list, unit_rays); });
+
+    for (size_t count : { size_t(1000), size_t(100000) }) {
+        // Synthetic scenes: random spheres in a 100-unit cube, rays from outside it through it.
+        if (!suite.wants("bvh_node::hit"))
+            break;
+        seed_random(count);
+        hittable_list list;
+        for (size_t k = 0; k < count; k++)
+            list.add(make_shared<sphere>(vec3::random(-50, 50), random_double(0.1, 1.0), mat));
+        bvh_node tree(list);
+        auto scene_rays = rays_toward(100, 50, 1 << 14);
+        suite.run("bvh_node::hit " + std::to_string(count) + " spheres", "ray", scene_rays.size(),
+                  [&] { return count_hits(tree, scene_rays); });
+    }
+
+    // Scatter from a surface facing +y, hit from above at random angles.
+    hit_record rec;
+    rec.p = point3(0,0,0);
+    rec.normal = vec3(0,1,0);
+    rec.t = 1;
+    rec.front_face = true;
+    std::vector<ray> incoming;
+    seed_random(2);
+    for (int k = 0; k < 4096; k++)
+        incoming.push_back(ray(point3(0,1,0), vec3(random_double(-1,1), -1, random_double(-1,1)), 0));
+    lambertian diffuse(color(0.5, 0.5, 0.5));
+    metal fuzzy_metal(color(0.7, 0.6, 0.5), 0.3);
+    dielectric glass(1.5);
+    const material* materials[] = { &diffuse, &fuzzy_metal, &glass };
+    const char* material_names[] = { "lambertian", "metal", "dielectric" };
+    for (int m = 0; m < 3; m++) {
+        // The renderer scatters through scatter_material(), which switches on the material kind; the virtual
+        // material::scatter is kept as a second row to show what the switch saves.
+        suite.run(std::string("scatter_material ") + material_names[m], "scatter", incoming.size(), [&] {
+            double sum = 0;
+            color attenuation;
+            ray scattered;
+            for (const auto& r : incoming)
+                if (scatter_material(*materials[m], r, rec, attenuation, scattered))
+                    sum += scattered.direction().y() + attenuation.x();
+            return sum;
+        });
+        suite.run(std::string(material_names[m]) + "::scatter (virtual)", "scatter", incoming.size(), [&] {
+            double sum = 0;
+            color attenuation;
+            ray scattered;
+            for (const auto& r : incoming)
+                if (materials[m]->scatter(r, rec, attenuation, scattered))
+                    sum += scattered.direction().y() + attenuation.x();
+            return sum;
+        });
+    }
+
+    const size_t sample_count = 1 << 18;
+    const vec3 normal = unit_vector(vec3(0.3, 0.9, -0.2));
+    suite.run("random_double", "number", sample_count, [&] {
+        double sum = 0;
+        for (size_t k = 0; k < sample_count; k++)
+            sum += random_double();
+        return sum;
+    });
+    auto sampler = [&](const char* name, vec3 (*sample)(const vec3&)) {
+        suite.run(name, "sample", sample_count, [&] {
+            vec3 sum;
+            for (size_t k = 0; k < sample_count; k++)
+                sum += sample(normal);
+            return sum.x() + sum.y() + sum.z();
+        });
+    };
+    sampler("random_in_unit_disk", [](const vec3&) { return random_in_unit_disk(); });
+    sampler("random_in_unit_sphere", [](const vec3&) { return random_in_unit_sphere(); });
+    sampler("random_unit_vector", [](const vec3&) { return random_unit_vector(); });
+    sampler("random_cosine_direction", [](const vec3& n) { return random_cosine_direction(n); });
+    sampler("random_on_hemisphere", [](const vec3& n) { return random_on_hemisphere(n); });
+}
+
+static void bench_sphere_layout() {
+    // Compares the sphere class against sphere_set on the same random spheres (a quarter of them moving):
+    // memory per sphere, and brute-force intersection throughput with every ray tested against every sphere.
+    const size_t sphere_count = 20000;
+    const int ray_count = 500;
+
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    hittable_list list;
+    sphere_set set;
+    auto mat_index = set.add_material(mat);
+
+    counted_bytes = 0;
+    for (size_t i = 0; i < sphere_count; i++) {
+        auto center = point3(random_double(-50,50), random_double(-50,50), random_double(-50,50));
+        auto radius = random_double(0.1, 1.0);
+        if (i % 4 == 0) {
+            auto center2 = center + vec3(0, random_double(0,.5), 0);
+            list.add(std::allocate_shared<sphere>(counting_allocator<sphere>(), center, center2, radius, mat));
+            set.add(center, center2, radius, mat_index);
+        } else {
+            list.add(std::allocate_shared<sphere>(counting_allocator<sphere>(), center, radius, mat));
+            set.add(center, radius, mat_index);
+        }
+    }
+    set.shrink_to_fit();
+
+    // The sphere class also needs its shared_ptr slot in hittable_list::objects.
+    double class_bytes = static_cast<double>(counted_bytes) / sphere_count + sizeof(shared_ptr<hittable>);
+    double packed_bytes = static_cast<double>(set.memory_bytes()) / sphere_count;
+
+    std::vector<ray> rays;
+    for (int k = 0; k < ray_count; k++)
+        rays.push_back(ray(point3(0,0,-100), vec3::random(-0.5,0.5) + vec3(0,0,1), random_double()));
+
+    size_t class_hits = 0, packed_hits = 0;
+    hit_record rec;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+        for (const auto& object : list.objects)
+            class_hits += object->hit(r, interval(0.001, infinity), rec);
+    double class_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+        for (size_t i = 0; i < set.size(); i++)
+            packed_hits += set.hit(i, r, interval(0.001, infinity), rec);
+    double packed_seconds = seconds_since(start);
+
+    double tests = static_cast<double>(ray_count) * sphere_count;
+    std::printf("sphere layout (%zu spheres, %d rays)\n", sphere_count, ray_count);
+    std::printf("  %-12s %8.1f bytes/sphere %8.2f ns/test %8.1f Mtests/s (hits %zu)\n",
+                "sphere", class_bytes, class_seconds * 1e9 / tests, tests / class_seconds / 1e6, class_hits);
+    std::printf("  %-12s %8.1f bytes/sphere %8.2f ns/test %8.1f Mtests/s (hits %zu)\n",
+                "sphere_set", packed_bytes, packed_seconds * 1e9 / tests, tests / packed_seconds / 1e6, packed_hits);
+}
+
+static void bench_ray_generation() {
+    // Primary rays per second for each camera feature combination, nothing traced.
+    struct variant { const char* name; double defocus_angle; bool motion_blur; jitter_mode jitter; };
+    const variant variants[] = {
+        { "pinhole, static, center", 0.0, false, jitter_none },
+        { "pinhole, static, random", 0.0, false, jitter_random },
+        { "pinhole, blur, random",   0.0, true,  jitter_random },
+        { "lens, blur, random",      0.6, true,  jitter_random },
+        { "lens, blur, stratified",  0.6, true,  jitter_stratified },
+    };
+
+    std::printf("primary ray generation (400 x 225, 100 spp)\n");
+    for (const auto& v : variants) {
+        camera cam;
+        cam.aspect_ratio = 16.0 / 9.0;
+        cam.image_width = 400;
+        cam.samples_per_pixel = 100;
+        cam.vfov = 20;
+        cam.lookfrom = point3(13,2,3);
+        cam.focus_dist = 10.0;
+        cam.defocus_angle = v.defocus_angle;
+        cam.motion_blur = v.motion_blur;
+        cam.jitter = v.jitter;
+
+        std::vector<ray> rays;
+        const int rows = 225;
+        double checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < rows; j++) {
+            rays.clear();
+            cam.primary_rays(j, rays);
+            checksum += rays.back().direction().x();
+        }
+        double seconds = seconds_since(start);
+        double count = static_cast<double>(rows) * cam.image_width * cam.samples_per_pixel;
+        std::printf("  %-24s %8.2f ns/ray %8.1f Mrays/s (checksum %.3f)\n",
+                    v.name, seconds * 1e9 / count, count / seconds / 1e6, checksum);
+    }
+}
+
+// The rejection samplers vec3.h used before the analytic ones, kept here as the baseline.
+static vec3 rejection_in_unit_disk() {
+    while (true) {
+        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
+        if (p.length_squared() < 1)
+            return p;
+    }
+}
+
+static vec3 rejection_in_unit_sphere() {
+    while (true) {
+        auto p = vec3::random(-1,1);
+        if (p.length_squared() < 1)
+            return p;
+    }
+}
+
+static vec3 rejection_unit_vector() {
+    return unit_vector(rejection_in_unit_sphere());
+}
+
+template <typename sampler>
+static double ns_per_sample(sampler sample, int count, double& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    vec3 sum;
+    for (int i = 0; i < count; i++)
+        sum += sample();
+    checksum = sum.x() + sum.y() + sum.z();
+    return seconds_since(start) * 1e9 / count;
+}
+
+static void bench_samplers() {
+    // Rejection loops against the analytic warps in sampling.h, both drawing from random_double(),
+    // then the batched warps on pre-drawn uniforms, which shows the mapping cost without the generator.
+    const int count = 1 << 20;
+    const vec3 normal = unit_vector(vec3(0.3, 0.9, -0.2));
+    double checksum;
+
+    std::printf("samplers (%d samples, ns/sample including random_double)\n", count);
+    auto row = [&](const char* name, double rejection, double analytic) {
+        std::printf("  %-18s rejection %7.2f   analytic %7.2f\n", name, rejection, analytic);
+    };
+    row("unit disk",
+        ns_per_sample(rejection_in_unit_disk, count, checksum),
+        ns_per_sample(random_in_unit_disk, count, checksum));
+    row("unit ball",
+        ns_per_sample(rejection_in_unit_sphere, count, checksum),
+        ns_per_sample(random_in_unit_sphere, count, checksum));
+    row("unit vector",
+        ns_per_sample(rejection_unit_vector, count, checksum),
+        ns_per_sample(random_unit_vector, count, checksum));
+    row("cosine direction",
+        ns_per_sample([&]() { return normal + rejection_unit_vector(); }, count, checksum),
+        ns_per_sample([&]() { return random_cosine_direction(normal); }, count, checksum));
+
+    std::vector<double> u1(count), u2(count), u3(count), x(count), y(count), z(count);
+    for (int i = 0; i < count; i++) {
+        u1[i] = random_double();
+        u2[i] = random_double();
+        u3[i] = random_double();
+    }
+
+    std::printf("batched samplers on pre-drawn uniforms (ns/sample)\n");
+    auto batched = [&](const char* name, int kind) {
+        auto start = std::chrono::steady_clock::now();
+        switch (kind) {
+            case 0: sample_disk(u1.data(), u2.data(), x.data(), y.data(), count); break;
+            case 1: sample_ball(u1.data(), u2.data(), u3.data(), x.data(), y.data(), z.data(), count); break;
+            case 2: sample_sphere_surface(u1.data(), u2.data(), x.data(), y.data(), z.data(), count); break;
+            default: sample_cosine_hemisphere(u1.data(), u2.data(), x.data(), y.data(), z.data(), count); break;
+        }
+        double ns = seconds_since(start) * 1e9 / count;
+        std::printf("  %-18s %7.2f (x[1] %.3f)\n", name, ns, x[1]);
+    };
+    batched("unit disk", 0);
+    batched("unit ball", 1);
+    batched("unit vector", 2);
+    batched("cosine hemisphere", 3);
+}
+
+template <typename world_type>
+static double trace_rays(const world_type& world, const std::vector<ray>& rays, size_t& hits) {
+    // The static type of world decides whether hit() is a virtual call or a direct, inlinable one.
+    hit_record rec;
+    hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+        hits += world.hit(r, interval(0.001, infinity), rec);
+    return seconds_since(start);
+}
+
+static void bench_hit_dispatch() {
+    // Same spheres, same compressed BVH layout: traced through hittable& with virtual primitive hits,
+    // and through the concrete compressed_bvh<object_set<sphere>> the typed render kernel uses.
+    const size_t sphere_count = 20000;
+    const int ray_count = 200000;
+
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    std::vector<shared_ptr<sphere>> spheres;
+    hittable_list list;
+    for (size_t i = 0; i < sphere_count; i++) {
+        auto s = make_shared<sphere>(point3(random_double(-50,50), random_double(-50,50), random_double(-50,50)),
+                                     random_double(0.1, 1.0), mat);
+        spheres.push_back(s);
+        list.add(s);
+    }
+    compressed_bvh<hittable_set> virtual_tree(list);
+    compressed_bvh<object_set<sphere>> typed_tree(spheres);
+    const hittable& virtual_world = virtual_tree;
+
+    std::vector<ray> rays;
+    for (int k = 0; k < ray_count; k++)
+        rays.push_back(ray(point3(0,0,-100), vec3::random(-0.5,0.5) + vec3(0,0,1), 0));
+
+    size_t virtual_hits, typed_hits;
+    double virtual_seconds = trace_rays(virtual_world, rays, virtual_hits);
+    double typed_seconds = trace_rays(typed_tree, rays, typed_hits);
+
+    std::printf("hit dispatch (%zu spheres, %d rays)\n", sphere_count, ray_count);
+    std::printf("  %-24s %8.1f ns/ray (hits %zu)\n", "hittable&, virtual", virtual_seconds * 1e9 / ray_count, virtual_hits);
+    std::printf("  %-24s %8.1f ns/ray (hits %zu)\n", "concrete, inlined", typed_seconds * 1e9 / ray_count, typed_hits);
+}
+
+int main(int argc, const char * argv[]) {
+    // --repetitions <n>: timed batches per kernel, --filter <text>: only the kernels whose name contains it,
+    // --json <file>: also write the kernel results there, --kernels: skip the comparisons after the kernels.
+    kernel_suite suite;
+    std::string json_path;
+    bool kernels_only = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+            suite.repetitions = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            suite.filter = argv[++i];
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (std::strcmp(argv[i], "--kernels") == 0)
+            kernels_only = true;
+        else {
+            std::fprintf(stderr, "Unknown argument %s.\n"
+                                 "Usage: bench [--repetitions <n>] [--filter <text>] [--json <file>] [--kernels]\n", argv[i]);
+            return 1;
+        }
+    }
+
+    bench_kernels(suite);
+    if (!json_path.empty() && !suite.write_json(json_path))
+        return 1;
+    if (kernels_only || !suite.filter.empty())
+        return 0;
+
+    bench_sphere_layout();
+    bench_ray_generation();
+    bench_hit_dispatch();
+    bench_samplers();
+    return 0;
+}
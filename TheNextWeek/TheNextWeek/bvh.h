@@ -10,16 +10,25 @@
 
 #include "rtweekend.h"
 
+#include "arena.h"
 #include "hittable.h"
 #include "hittable_list.h"
 
 #include <algorithm>
 
-class bvh_node : public hittable {
+class bvh_node final : public hittable {
 public:
-    bvh_node(const hittable_list& list) : bvh_node(list.objects, 0, list.objects.size()) {}
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end) {
-        auto objects = src_objects; // Create a modifiable array of the source scene objects
+    bvh_node(const hittable_list& list) : bvh_node(hittable_list(list).objects, 0, list.objects.size()) {}
+    bvh_node(std::vector<shared_ptr<hittable>>&& src_objects, size_t start, size_t end) : bvh_node(src_objects, start, end) {}
+    bvh_node(const hittable_list& list, arena& node_arena)
+        : bvh_node(hittable_list(list).objects, 0, list.objects.size(), &node_arena) {}
+    bvh_node(std::vector<shared_ptr<hittable>>&& src_objects, size_t start, size_t end, arena* node_arena)
+        : bvh_node(src_objects, start, end, node_arena) {}
+    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, arena* node_arena = nullptr) {
+        // Sorts objects[start,end) in place. Every subtree only touches its own range, so the array is copied
+        // once for the whole tree instead of once per node. (the copy per node made large builds quadratic)
+        // With node_arena, child nodes are placed in the arena and every child pointer is borrowed, so the
+        // primitives must outlive the tree (they normally live in the same scene_arena).
         
         // First, randomly choose an axis.
         int axis = random_int(0,2);
@@ -31,27 +40,35 @@ public:
         
         // Then, sort the primitives.
         if (object_span == 1) {
-            left = right = objects[start];
+            left = right = leaf(objects[start], node_arena);
         } else if (object_span == 2) {
             if (comparator(objects[start], objects[start+1])) {
-                left = objects[start];
-                right = objects[start+1];
+                left = leaf(objects[start], node_arena);
+                right = leaf(objects[start+1], node_arena);
             } else {
-                left = objects[start+1];
-                right = objects[start];
+                left = leaf(objects[start+1], node_arena);
+                right = leaf(objects[start], node_arena);
             }
         } else {
             std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
             auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            if (node_arena) {
+                left = arena::borrow(node_arena->create<bvh_node>(objects, start, mid, node_arena));
+                right = arena::borrow(node_arena->create<bvh_node>(objects, mid, end, node_arena));
+            } else {
+                left = make_shared<bvh_node>(objects, start, mid);
+                right = make_shared<bvh_node>(objects, mid, end);
+            }
         }
         
         // Lastly, put half in each subtree.
         bbox = aabb(left->bounding_box(), right->bounding_box());
     }
     
+    bvh_node(shared_ptr<hittable> _left, shared_ptr<hittable> _right)
+        : left(_left), right(_right), bbox(_left->bounding_box(), _right->bounding_box()) {}   // Used to rebuild a cached tree.
+    
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // check whether the box for the node is hit.
         // and if so, check the children and sort out any details.
@@ -72,20 +89,26 @@ private:
     shared_ptr<hittable> right;
     aabb bbox;
     
-    static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index)
+    friend class bvh_cache;
+    
+    static shared_ptr<hittable> leaf(const shared_ptr<hittable>& object, arena* node_arena) {
+        return node_arena ? arena::borrow(object.get()) : object;
+    }
+    
+    static bool box_compare(const shared_ptr<hittable>& a, const shared_ptr<hittable>& b, int axis_index)
     {
         return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
     }
     
-    static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+    static bool box_x_compare (const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
         return box_compare(a, b, 0);
     }
     
-    static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+    static bool box_y_compare (const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
         return box_compare(a, b, 1);
     }
     
-    static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+    static bool box_z_compare (const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
         return box_compare(a, b, 2);
     }
 };
@@ -0,0 +1,228 @@
+//
+//  bvh_cache.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Bump whenever bvh_node's split rule changes, so trees built by an older builder are never reused.
+const uint32_t bvh_builder_version = 1;
+
+class bvh_cache {
+public:
+    bvh_cache(const std::string& cache_directory) : directory(cache_directory) {}
+
+    shared_ptr<hittable> load_or_build(const hittable_list& list) {
+        // Returns the root of a bvh_node tree over list.objects, reusing a cached topology when the scene matches.
+        if (list.objects.empty())
+            return make_shared<hittable_list>(list);
+
+        auto key = scene_key(list);
+        auto path = cache_path(key);
+
+        auto root = load(path, list, key);
+        if (root) {
+            std::clog << "Loaded BVH from cache " << path << ".\n";
+            return root;
+        }
+
+        auto built = make_shared<bvh_node>(list);
+        if (save(path, *built, list, key))
+            std::clog << "Saved BVH to cache " << path << ".\n";
+        return built;
+    }
+
+    static uint64_t scene_key(const hittable_list& list) {
+        // The tree only depends on the primitive bounds (and the builder), so that is all the key covers.
+        // Materials or other per-primitive data can change without invalidating the cache.
+        uint64_t h = 14695981039346656037ull;
+        h = mix(h, bvh_builder_version);
+        h = mix(h, list.objects.size());
+        for (const auto& object : list.objects) {
+            auto box = object->bounding_box();
+            for (int a = 0; a < 3; a++) {
+                h = mix(h, bits(box.axis(a).min));
+                h = mix(h, bits(box.axis(a).max));
+            }
+        }
+        return h;
+    }
+
+private:
+    std::string directory;
+
+    struct file_header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t builder_version;
+        uint64_t scene_key;
+        uint64_t primitive_count;
+        uint64_t node_count;
+        uint64_t payload_hash;
+    };
+
+    // A child reference: >= 0 is a node index, < 0 is primitive ~ref in list.objects.
+    struct node_entry {
+        int64_t left, right;
+    };
+
+    static uint64_t mix(uint64_t h, uint64_t word) {
+        h ^= word;
+        h *= 1099511628211ull;
+        return h ^ (h >> 32);
+    }
+
+    static uint64_t bits(double x) {
+        uint64_t u;
+        std::memcpy(&u, &x, sizeof(u));
+        return u;
+    }
+
+    static uint64_t payload_hash(const std::vector<node_entry>& nodes) {
+        uint64_t h = 14695981039346656037ull;
+        for (const auto& n : nodes) {
+            h = mix(h, static_cast<uint64_t>(n.left));
+            h = mix(h, static_cast<uint64_t>(n.right));
+        }
+        return h;
+    }
+
+    std::string cache_path(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+        return directory + "/" + name;
+    }
+
+    shared_ptr<hittable> load(const std::string& path, const hittable_list& list, uint64_t key) const {
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f)
+            return nullptr;
+
+        file_header header;
+        std::vector<node_entry> nodes;
+        bool ok = std::fread(&header, sizeof(header), 1, f) == 1
+               && std::memcmp(header.magic, "RTBVHC\0\0", 8) == 0
+               && header.version == 1
+               && header.builder_version == bvh_builder_version
+               && header.scene_key == key
+               && header.primitive_count == list.objects.size()
+               && header.node_count > 0
+               && header.node_count < 2 * list.objects.size();
+        if (ok) {
+            nodes.resize(header.node_count);
+            ok = std::fread(nodes.data(), sizeof(node_entry), nodes.size(), f) == nodes.size()
+              && payload_hash(nodes) == header.payload_hash;
+        }
+        std::fclose(f);
+
+        if (!ok) {
+            std::clog << "Ignoring stale or damaged BVH cache " << path << ".\n";
+            return nullptr;
+        }
+
+        // Children are always stored after their parent, so building from the back only ever refers to
+        // nodes that already exist; this check also rules out cycles in a corrupted file.
+        std::vector<shared_ptr<hittable>> built(nodes.size());
+        auto n = static_cast<int64_t>(nodes.size());
+        auto primitives = static_cast<int64_t>(list.objects.size());
+        for (int64_t i = n - 1; i >= 0; i--) {
+            auto resolve = [&](int64_t ref) -> shared_ptr<hittable> {
+                if (ref < 0)
+                    return (~ref < primitives) ? list.objects[~ref] : nullptr;
+                return (ref > i && ref < n) ? built[ref] : nullptr;
+            };
+            auto left = resolve(nodes[i].left);
+            auto right = resolve(nodes[i].right);
+            if (!left || !right) {
+                std::clog << "Ignoring damaged BVH cache " << path << ".\n";
+                return nullptr;
+            }
+            built[i] = make_shared<bvh_node>(left, right);
+        }
+        return built[0];
+    }
+
+    bool save(const std::string& path, const bvh_node& root, const hittable_list& list, uint64_t key) const {
+        std::unordered_map<const hittable*, int64_t> primitive_index;
+        primitive_index.reserve(list.objects.size());
+        for (size_t i = 0; i < list.objects.size(); i++)
+            primitive_index.emplace(list.objects[i].get(), static_cast<int64_t>(i));
+
+        std::vector<node_entry> nodes;
+        nodes.reserve(list.objects.size());
+        flatten(root, primitive_index, nodes);
+
+        file_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "RTBVHC\0\0", 8);
+        header.version = 1;
+        header.builder_version = bvh_builder_version;
+        header.scene_key = key;
+        header.primitive_count = list.objects.size();
+        header.node_count = nodes.size();
+        header.payload_hash = payload_hash(nodes);
+
+        mkdir(directory.c_str(), 0755);
+
+        // Write under a temporary name and rename, so a crash never leaves a truncated cache entry behind.
+        auto tmp_path = path + ".tmp";
+        FILE* f = std::fopen(tmp_path.c_str(), "wb");
+        if (!f) {
+            std::clog << "Cannot write BVH cache " << tmp_path << ".\n";
+            return false;
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+               && std::fwrite(nodes.data(), sizeof(node_entry), nodes.size(), f) == nodes.size();
+        ok = (std::fclose(f) == 0) && ok;
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static int64_t flatten(const bvh_node& node, const std::unordered_map<const hittable*, int64_t>& primitive_index,
+                           std::vector<node_entry>& nodes) {
+        // Pre-order: a node's index is always smaller than its children's.
+        auto index = static_cast<int64_t>(nodes.size());
+        nodes.push_back(node_entry());
+
+        int64_t refs[2];
+        const shared_ptr<hittable>* children[2] = { &node.left, &node.right };
+        for (int c = 0; c < 2; c++) {
+            auto found = primitive_index.find(children[c]->get());
+            if (found != primitive_index.end())
+                refs[c] = ~found->second;
+            else
+                refs[c] = flatten(static_cast<const bvh_node&>(**children[c]), primitive_index, nodes);
+        }
+
+        nodes[index].left = refs[0];
+        nodes[index].right = refs[1];
+        return index;
+    }
+};
+
+#endif /* BVH_CACHE_H */
+
+// Note
+// bvh_node의 topology (node마다 어떤 두 child를 가지는지)만 저장하고, bounding box는 로드할 때 child로부터 다시 계산함.
+// 그래서 캐시가 맞으면 sort 없이 O(n)으로 트리를 재구성할 수 있고, 카메라나 spp만 바뀐 re-render는 BVH 빌드 비용 없이 바로 시작.
+// The key hashes every primitive's bounds plus the builder version; any miss, mismatch or damaged file falls back to a fresh build.
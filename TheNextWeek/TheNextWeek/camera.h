@@ -11,13 +11,35 @@
 #include "rtweekend.h"
 
 #include "color.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "image_stream.h"
+#include "image_writer.h"
 #include "material.h"
+#include "render_farm.h"
+#include "tile_store.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+enum jitter_mode {
+    jitter_random,      // uniform random position inside the pixel
+    jitter_stratified,  // one random position per cell of a sqrt(spp) x sqrt(spp) grid
+    jitter_none,        // pixel centers only
+};
+
 class camera {
 public:
     double aspect_ratio      = 1.0;  // Ratio of image width over height
@@ -33,43 +55,1052 @@ public:
     double defocus_angle = 0;   // Variation angle of rays through each pixel
     double focus_dist = 10;     // Distance from camera lookfrom point to plane of perfect focus (replaces focal_length)
     
-    void render(const hittable& world) {
+    bool        motion_blur = true;             // Random ray times in [0,1); off renders every ray at time 0
+    jitter_mode jitter      = jitter_random;    // Where the samples of a pixel are placed
+    
+    resolve_settings tonemap;   // Exposure and tone curve used to turn the accumulated radiance into the PNG
+    std::string      hdr_path;  // When set, the linear radiance is also written there as PFM
+    
+    std::string output_path     = "./TheNextWeek/result/01_bouncingspheres.png";   // The PNG
+    png_level   png_compression = png_default;
+    int         encode_threads  = 0;    // PNG encoder threads; 0 = one per hardware thread
+    
+    std::string checkpoint_path;            // When set, the accumulation state is saved there while rendering
+    double      checkpoint_seconds = 60;    // Minimum time between checkpoints; the finished image is always saved
+    bool        resume = false;             // Start from checkpoint_path: render only the samples it is missing
+    
+    bool   progressive        = false;  // Render one sample per pixel per pass instead of all samples row by row
+    int    snapshot_passes    = 0;      // Progressive: write the image every n passes (0 = off)
+    double snapshot_seconds   = 0;      // Progressive: write the image when this much time has passed since the last (0 = off)
+    double time_budget        = 0;      // Progressive: seconds; no pass is started that would end after it (0 = none)
+    double noise_target       = 0;      // Progressive: stop once image_noise() is below this (0 = none)
+    
+    int           threads   = 0;            // Render threads; 0 = one per hardware thread
+    int           tile_size = 32;           // Edge of the square tiles the threads take from the image
+    stream_format stream    = stream_none;  // Also write the image to stdout, band by band as it is finished
+    
+    std::string tile_path;  // When set, render out of core: finished tiles go to this tile file instead of memory
+    
+    int    views         = 1;     // Views rendered in one pass, side by side along the camera's u axis (2 = stereo pair)
+    double view_baseline = 0.065; // Distance between neighbouring view origins; the views converge at focus_dist
+    double view_share    = 0;     // Diffuse hits of two views closer than this many pixels share one indirect path (0 = never;
+                                  // sharing is faster but biased: it blurs indirect light across the views)
+    
+    bool   temporal           = false;  // Reuse the previous render's radiance where reprojection finds the same surface
+    int    temporal_samples   = 4;      // Temporal: fresh samples per pixel once there is history (the first frame gets all)
+    double temporal_tolerance = 0.02;   // Temporal: history is rejected when its surface point is off by more than this
+                                        // fraction of the distance to the camera
+    bool   temporal_check     = false;  // Temporal: also render a full samples_per_pixel reference and report the error
+    
+    std::string farm_listen;            // When set, coordinate: workers connecting here trace the tiles, this process merges them
+    std::string farm_worker;            // When set, trace tiles for the coordinator at this address instead of making an image
+    double      unit_timeout = 120;     // Coordinator: seconds before a tile still out is also given to another worker
+    
+    template <typename world_type>
+    void render(const world_type& world) {
+        // world_type is the static type of the scene. With hittable (or hittable_list) every intersection is a
+        // virtual call; with a concrete final accelerator such as compressed_bvh<object_set<sphere>> the compiler
+        // sees the whole chain (traversal, sphere::hit, material scatter) and builds one kernel per scene type.
+        // The world is shared by all render threads, so its hit() must be safe to call concurrently.
+        if (views > 1) {
+            render_views(world);
+            return;
+        }
+        if (temporal) {
+            render_temporal(world);
+            return;
+        }
+        render_image(worker_count(), [&](const image_tile& tile, int target, tile_buffer& out) {
+            trace_tile(world, tile, target, out);
+        });
+    }
+    
+    bool modes_compatible() const {
+        // render() sends multi-view and temporal renders down their own paths, which have none of render_image's
+        // modes (nor each other's): reject the settings it would otherwise quietly drop.
+        bool image_modes = stream != stream_none || !checkpoint_path.empty() || progressive || !tile_path.empty()
+                        || !farm_listen.empty() || !farm_worker.empty();
+        if (views > 1 && image_modes) {
+            std::clog << "--views renders in one pass to memory; it can't be combined with --stream, --checkpoint, "
+                         "--progressive, --tiles-out, --coordinate or --worker.\n";
+            return false;
+        }
+        if (temporal && image_modes) {
+            std::clog << "--temporal renders in one pass to memory; it can't be combined with --stream, --checkpoint, "
+                         "--progressive, --tiles-out, --coordinate or --worker.\n";
+            return false;
+        }
+        if (temporal && views > 1) {
+            std::clog << "--temporal and --views can't be combined.\n";
+            return false;
+        }
+        return true;
+    }
+    
+    template <typename batch_world>
+    void render_batched(const batch_world& world) {
+        // Same image as render(), but traced breadth first: all paths of a tile row advance one bounce at a time
+        // and each bounce is handed to world.trace() as one batch. Meant for worlds like paged_bvh that
+        // do better with many rays at once than with one ray at a time.
+        // One render thread: the batches are what make it fast, and paged_bvh's pins assume one tracer.
+        render_image(1, [&](const image_tile& tile, int target, tile_buffer& out) {
+            trace_tile_batched(world, tile, target, out);
+        });
+    }
+    
+    // Tile by tile rendering for callers that run their own threads (render_server): start_image() once, then
+    // render_tile() for every entry of image_tiles(), from any threads and in any order, then save_image().
+    void start_image(framebuffer& image, shared_ptr<image_writer> shared_writer) {
+        initialize();
+        begin_image(image);
+        share_writer(shared_writer);
+    }
+    
+    void share_writer(shared_ptr<image_writer> shared_writer) {
+        // Renders hand their images to this writer and return without waiting for the PNG; draining it is up to
+        // the caller (animation sequences encode frame n while frame n+1 renders).
+        writer = shared_writer;
+        writer_shared = true;
+    }
+    
+    std::vector<image_tile> image_tiles() const {
+        int size = std::max(tile_size, 1);
+        std::vector<image_tile> tiles;
+        for (int y0 = 0; y0 < image_height; y0 += size)
+            for (int x0 = 0; x0 < image_width; x0 += size)
+                tiles.push_back(image_tile{x0, y0, std::min(x0 + size, image_width), std::min(y0 + size, image_height)});
+        return tiles;
+    }
+    
+    template <typename world_type>
+    void render_tile(const world_type& world, framebuffer& image, const image_tile& tile, std::mutex& image_lock) const {
+        // The tile is committed under image_lock, which every thread rendering into this image must share.
+        tile_buffer buffer;
+        buffer.reset(tile, &image);
+        trace_tile(world, tile, samples_per_pixel, buffer);
+        std::lock_guard<std::mutex> guard(image_lock);
+        commit_tile(image, tile, buffer);
+    }
+    
+    void save_image(const framebuffer& image, std::function<void(bool)> written) const {
+        // written(ok) is called on a writer thread once the PNG is on disk.
+        finish_image(image, std::move(written));
+    }
+    
+    void primary_rays(int j, std::vector<ray>& rays) {
+        // Appends the camera rays of scanline j (samples_per_pixel per pixel, left to right) exactly as the
+        // renderers generate them. Lets ray generation be measured on its own.
+        initialize();
+        (this->*scanline_rays)(j, 0, image_width, 0, samples_per_pixel, rays);
+    }
+    
+private:
+    int    image_height;   // Rendered image height
+    point3 center;         // Camera center
+    point3 pixel00_loc;    // Location of pixel 0,0
+    vec3   pixel_delta_u;  // Offset to pixel to the right
+    vec3   pixel_delta_v;  // Offset to pixel below
+    vec3   u, v, w;        // Camera frame basis vectors
+    vec3   defocus_disk_u;  // Defocus disk horizontal radius
+    vec3   defocus_disk_v;  // Defocus disk vertical radius
+    int    strata;          // Grid size for jitter_stratified
+    double inv_strata;
+    
+    // Scanline ray generator specialized on the camera's features, chosen once by initialize().
+    void (camera::*scanline_rays)(int j, int x0, int x1, int first_sample, int count, std::vector<ray>& rays) const = nullptr;
+    
+    struct tile_buffer {
+        // One render thread's results for the tile it is working on, committed to the framebuffer in one go.
+        std::vector<color>  sum;            // per pixel of the tile, row major
+        std::vector<double> luminance_sq;
+        std::vector<int>    first_sample;   // samples each row of the tile already has, set before tracing
+        std::vector<int>    row_samples;    // samples added to each row of the tile (0 = row skipped)
+        std::vector<ray>    rays;           // scratch for the kernels
+        
+        void reset(const image_tile& tile, const framebuffer* image) {
+            // Without an image every row starts from its first sample.
+            size_t n = static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+            sum.assign(n, color(0,0,0));
+            luminance_sq.assign(n, 0.0);
+            first_sample.assign(tile.y1 - tile.y0, 0);
+            row_samples.assign(tile.y1 - tile.y0, 0);
+            for (int j = tile.y0; image && j < tile.y1; ++j)
+                first_sample[j - tile.y0] = static_cast<int>(image->samples(tile.x0, j));
+        }
+    };
+    
+    int worker_count() const {
+        if (threads > 0)
+            return threads;
+        int n = static_cast<int>(std::thread::hardware_concurrency());
+        return n > 0 ? n : 1;
+    }
+    
+    template <typename tile_function>
+    void render_image(int workers, tile_function trace) {
+        // trace(tile, target, out) renders the samples a tile is missing (out.first_sample) up to `target` per pixel
+        // into out.
+        // A pass runs it over every tile; normally one pass with samples_per_pixel, while progressive mode raises
+        // the target by one per pass and writes the image as it goes.
+        initialize();
+        if (!farm_worker.empty()) {
+            work_for_farm(workers, trace);
+            return;
+        }
+        if (!tile_path.empty()) {
+            render_out_of_core(workers, trace);
+            return;
+        }
+        
+        framebuffer image;
+        begin_image(image);
+        if (!writer)
+            writer = std::make_shared<image_writer>(encode_threads > 0 ? encode_threads : worker_count());
+        auto trace_pass = [&](framebuffer& target_image, int target, image_stream* out) {
+            run_pass(target_image, target, workers, trace, out);
+        };
+        
+        image_stream out(stdout, stream, tonemap);
+        bool streaming = stream != stream_none && farm_listen.empty() && out.begin(image_width, image_height);
+        if (!farm_listen.empty())
+            coordinate_farm(image);
+        else if (progressive)
+            render_progressive(image, trace_pass);
+        else
+            trace_pass(image, samples_per_pixel, streaming ? &out : nullptr);
+        std::clog << "\rDone.                                                  \n";
+        if (streaming && progressive)
+            stream_all(image, out);
+        finish_image(image);
+        if (!writer_shared)
+            writer->drain();
+    }
+    
+    template <typename tile_function>
+    void run_pass(framebuffer& image, int target, int workers, tile_function trace, image_stream* out) {
+        // Splits the image into bands of tile_size rows and each band into tiles. Threads take tiles in band order
+        // from a shared counter and commit each finished tile under the lock. This thread waits for the bands in
+        // order: a band is complete once all of its tiles are, whichever threads finished them and in what order,
+        // and is then streamed. It also writes the checkpoints, under the lock, so they only ever hold whole tiles.
+        int size = std::max(tile_size, 1);
+        int bands = (image_height + size - 1) / size;
+        int columns = (image_width + size - 1) / size;
+        bool bottom_up = out && out->bottom_up();
+        
+        std::vector<image_tile> tiles;
+        for (int b = 0; b < bands; ++b) {
+            int y0 = (bottom_up ? bands - 1 - b : b) * size;
+            for (int c = 0; c < columns; ++c)
+                tiles.push_back(image_tile{c * size, y0, std::min((c + 1) * size, image_width), std::min(y0 + size, image_height)});
+        }
+        
+        std::mutex lock;
+        std::condition_variable band_done;
+        std::vector<int> tiles_left(bands, columns);
+        std::atomic<size_t> next(0);
+        
+        auto work = [&]() {
+            tile_buffer buffer;
+            for (size_t t = next++; t < tiles.size(); t = next++) {
+                const auto& tile = tiles[t];
+                buffer.reset(tile, &image);
+                trace(tile, target, buffer);
+                
+                std::lock_guard<std::mutex> guard(lock);
+                commit_tile(image, tile, buffer);
+                if (--tiles_left[t / columns] == 0)
+                    band_done.notify_all();
+            }
+        };
+        
+        std::vector<std::thread> pool;
+        for (int k = 0; k < std::max(workers, 1); ++k)
+            pool.emplace_back(work);
+        
+        for (int b = 0; b < bands; ++b) {
+            std::unique_lock<std::mutex> guard(lock);
+            while (tiles_left[b] > 0) {
+                band_done.wait_for(guard, std::chrono::milliseconds(500));
+                if (!progressive)
+                    std::clog << "\rBands remaining: " << (bands - b) << ' ' << std::flush;
+                checkpoint_if_due(image);
+            }
+            checkpoint_if_due(image);
+            guard.unlock();
+            
+            if (out) {
+                int y0 = tiles[static_cast<size_t>(b) * columns].y0;
+                out->write_rows(image, y0, std::min(y0 + size, image_height));
+            }
+        }
+        for (auto& t : pool)
+            t.join();
+    }
+    
+    template <typename tile_function>
+    void render_out_of_core(int workers, tile_function trace) {
+        // For images whose framebuffer would not fit in memory. Each thread traces a tile with all its samples and
+        // stores the averaged tile in the tile file, so memory holds one tile per thread. Then the PNG (and PFM)
+        // are assembled from the file a band of tiles at a time. With resume, tiles already in the file at
+        // samples_per_pixel or more are kept; others are traced again from the first sample.
+        // Progressive mode, checkpoints and streaming to stdout don't apply here; the tile file is the checkpoint.
+        int size = std::max(tile_size, 1);
+        tile_store store;
+        if (!store.open(tile_path, image_width, image_height, size, job_key(), resume))
+            return;
+        
+        std::vector<int> todo;
+        for (int index = 0; index < store.columns() * store.bands(); ++index)
+            if (store.samples(index) < static_cast<uint32_t>(samples_per_pixel))
+                todo.push_back(index);
+        
+        std::mutex lock;
+        std::condition_variable tile_done;
+        size_t tiles_left = todo.size();
+        std::atomic<size_t> next(0);
+        stop_requested() = 0;
+        
+        auto work = [&]() {
+            tile_buffer buffer;
+            std::vector<float> rgb;
+            for (size_t t = next++; t < todo.size(); t = next++) {
+                auto tile = store.tile(todo[t]);
+                buffer.reset(tile, nullptr);
+                trace(tile, samples_per_pixel, buffer);
+                
+                rgb.resize(buffer.sum.size() * 3);
+                for (size_t p = 0; p < buffer.sum.size(); ++p)
+                    for (int c = 0; c < 3; ++c)
+                        rgb[p * 3 + c] = static_cast<float>(buffer.sum[p][c] / samples_per_pixel);
+                store.write_tile(todo[t], rgb, samples_per_pixel);
+                
+                std::lock_guard<std::mutex> guard(lock);
+                tiles_left--;
+                tile_done.notify_all();
+            }
+        };
+        
+        std::vector<std::thread> pool;
+        for (int k = 0; k < std::max(workers, 1); ++k)
+            pool.emplace_back(work);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (tiles_left > 0) {
+                std::clog << "\rTiles remaining: " << tiles_left << ' ' << std::flush;
+                tile_done.wait_for(guard, std::chrono::milliseconds(500));
+            }
+        }
+        for (auto& t : pool)
+            t.join();
+        std::clog << "\rAssembling.                                            \n";
+        
+        framebuffer band;
+        png_stream png;
+        bool ok = png.open(output_path, image_width, image_height, png_compression);
+        std::vector<uint8_t> rows;
+        for (int b = 0; b < store.bands() && ok; ++b) {
+            ok = store.read_band(b, band);
+            rows.resize(band.pixel_count() * 3);
+            band.resolve_rows(0, band.height(), rows.data(), tonemap);
+            ok = ok && png.write_rows(rows.data(), band.height());
+        }
+        if (ok)
+            png.close();
+        
+        if (!hdr_path.empty()) {
+            // PFM stores the bottom row first: the bands are read again in reverse.
+            FILE* f = std::fopen((hdr_path + ".tmp").c_str(), "wb");
+            image_stream pfm(f, stream_pfm, tonemap);
+            ok = f && pfm.begin(image_width, image_height);
+            for (int b = store.bands() - 1; b >= 0 && ok; --b)
+                ok = store.read_band(b, band) && pfm.write_rows(band, 0, band.height());
+            ok = f && (std::fclose(f) == 0) && ok;
+            if (!ok || std::rename((hdr_path + ".tmp").c_str(), hdr_path.c_str()) != 0)
+                std::clog << "Failed to write " << hdr_path << ".\n";
+        }
+        std::clog << "Done.\n";
+    }
+    
+    void coordinate_farm(framebuffer& image) {
+        // The tiles of run_pass become the farm's units, each with the samples it is missing (after a resume, only
+        // those). The framebuffer, checkpoints and output stay in this process; it traces nothing itself.
+        farm_coordinator farm;
+        if (!farm.listen(farm_listen))
+            return;
+        
+        int size = std::max(tile_size, 1);
+        std::vector<farm_work> work;
+        for (int y0 = 0; y0 < image_height; y0 += size) {
+            for (int x0 = 0; x0 < image_width; x0 += size) {
+                farm_work unit;
+                unit.id = static_cast<uint32_t>(work.size());
+                unit.tile = image_tile{x0, y0, std::min(x0 + size, image_width), std::min(y0 + size, image_height)};
+                unit.target = samples_per_pixel;
+                bool missing = false;
+                for (int j = unit.tile.y0; j < unit.tile.y1; ++j) {
+                    unit.rows.push_back(static_cast<int>(image.samples(x0, j)));
+                    missing = missing || unit.rows.back() < samples_per_pixel;
+                }
+                if (missing)
+                    work.push_back(unit);
+            }
+        }
+        
+        std::clog << "Waiting for workers on " << farm_listen << ": " << work.size() << " tiles.\n";
+        size_t tiles_left = work.size();
+        tile_buffer buffer;
+        auto commit = [&](const farm_work& result) {
+            buffer.reset(result.tile, nullptr);
+            buffer.row_samples = result.rows;
+            for (size_t p = 0; p < buffer.sum.size(); ++p) {
+                buffer.sum[p] = color(result.values[p * 4], result.values[p * 4 + 1], result.values[p * 4 + 2]);
+                buffer.luminance_sq[p] = result.values[p * 4 + 3];
+            }
+            commit_tile(image, result.tile, buffer);
+            tiles_left--;
+        };
+        farm.run(work, job_key(), unit_timeout, commit, [&]() {
+            std::clog << "\rTiles remaining: " << tiles_left << ' ' << std::flush;
+            checkpoint_if_due(image);
+        });
+    }
+    
+    template <typename tile_function>
+    void work_for_farm(int workers, tile_function trace) {
+        // One connection to the coordinator per render thread, each tracing the units it is given until the
+        // coordinator has no more. The results are the raw sums that commit_tile would add locally.
+        stop_requested() = 0;
+        std::atomic<int> units(0);
+        auto work = [&]() {
+            farm_worker_link link;
+            if (!link.connect(farm_worker, job_key(), 30))
+                return;
+            tile_buffer buffer;
+            farm_work unit;
+            while (link.next(unit)) {
+                buffer.reset(unit.tile, nullptr);
+                buffer.first_sample = unit.rows;
+                trace(unit.tile, unit.target, buffer);
+                
+                unit.rows = buffer.row_samples;
+                unit.values.resize(buffer.sum.size() * 4);
+                for (size_t p = 0; p < buffer.sum.size(); ++p) {
+                    for (int c = 0; c < 3; ++c)
+                        unit.values[p * 4 + c] = buffer.sum[p][c];
+                    unit.values[p * 4 + 3] = buffer.luminance_sq[p];
+                }
+                if (!link.send(unit))
+                    break;
+                units++;
+            }
+        };
+        
+        std::vector<std::thread> pool;
+        for (int k = 0; k < std::max(workers, 1); ++k)
+            pool.emplace_back(work);
+        for (auto& t : pool)
+            t.join();
+        std::clog << "Traced " << units << " tiles for " << farm_worker << ".\n";
+    }
+    
+    template <typename world_type>
+    void render_views(const world_type& world) {
+        // Multi-view (stereo, light field) rendering: every camera sample is traced from all `views` origins in
+        // the same pass, and each view accumulates into its own framebuffer, written as <output>_view<k>.png (and
+        // .pfm). By default this saves only the camera ray generation: every view still pays for its own
+        // traversal and paths, so n views cost about as much as n separate renders. The biased view_share mode
+        // saves only the indirect paths it reuses, which is well short of one traversal serving all views.
+        // Checkpoints, progressive mode, streaming, out-of-core and farm rendering are single-view only; modes_compatible()
+        // rejects them.
+        initialize();
+        if (!writer)
+            writer = std::make_shared<image_writer>(encode_threads > 0 ? encode_threads : worker_count());
+        std::vector<framebuffer> images(views);
+        for (auto& image : images)
+            image.reset(image_width, image_height);
+        
+        auto tiles = image_tiles();
+        std::mutex lock;
+        std::condition_variable tile_done;
+        size_t tiles_left = tiles.size();
+        std::atomic<size_t> next(0);
+        std::atomic<uint64_t> diffuse_hits(0), shared_paths(0);
+        stop_requested() = 0;
+        
+        auto work = [&]() {
+            std::vector<tile_buffer> buffers(views);
+            uint64_t hits = 0, shared = 0;
+            for (size_t t = next++; t < tiles.size(); t = next++) {
+                for (auto& buffer : buffers)
+                    buffer.reset(tiles[t], nullptr);
+                trace_tile_views(world, tiles[t], buffers, hits, shared);
+                
+                std::lock_guard<std::mutex> guard(lock);
+                for (int k = 0; k < views; ++k)
+                    commit_tile(images[k], tiles[t], buffers[k]);
+                tiles_left--;
+                tile_done.notify_all();
+            }
+            diffuse_hits += hits;
+            shared_paths += shared;
+        };
+        
+        std::vector<std::thread> pool;
+        for (int k = 0; k < worker_count(); ++k)
+            pool.emplace_back(work);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (tiles_left > 0) {
+                std::clog << "\rTiles remaining: " << tiles_left << ' ' << std::flush;
+                tile_done.wait_for(guard, std::chrono::milliseconds(500));
+            }
+        }
+        for (auto& t : pool)
+            t.join();
+        std::clog << "\rDone: " << views << " views, " << shared_paths << " of " << diffuse_hits
+                  << " diffuse hits shared an indirect path.\n";
+        
+        for (int k = 0; k < views; ++k)
+            write_image(images[k], view_path(output_path, k), hdr_path.empty() ? hdr_path : view_path(hdr_path, k), nullptr);
+        if (!writer_shared)
+            writer->drain();
+    }
+    
+    template <typename world_type>
+    void trace_tile_views(const world_type& world, const image_tile& tile, std::vector<tile_buffer>& out,
+                          uint64_t& diffuse_hits, uint64_t& shared_paths) const {
+        // The camera rays are made once, as for a single view, and moved to each view's origin keeping their point
+        // on the focus plane, lens offset and time. Each view's ray then goes through world.hit() on its own; the
+        // group shares no traversal. Their paths split from there, and each view is an unbiased render of its
+        // own. With view_share > 0 they don't split where two views see the same diffuse surface within
+        // view_share pixels of each other: the lambertian bounce doesn't depend on the incoming direction, so the
+        // later view reuses the indirect light gathered for the earlier one and only pays for its own primary ray.
+        // That is faster but biased: it blurs the indirect light across views by up to view_share pixels.
+        std::vector<ray> view_rays(views);
+        std::vector<hit_record> recs(views);
+        std::vector<bool> hits(views);
+        std::vector<color> indirect(views);
+        std::vector<bool> has_indirect(views);
+        double pixel_size = pixel_delta_u.length();
+        
+        size_t p = 0;
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            int first_sample, count;
+            if (!begin_span(out[0], tile, j, samples_per_pixel, first_sample, count)) {
+                p += tile.x1 - tile.x0;
+                continue;
+            }
+            out[0].rays.clear();
+            (this->*scanline_rays)(j, tile.x0, tile.x1, first_sample, count, out[0].rays);
+            for (auto& buffer : out)
+                buffer.row_samples[j - tile.y0] = count;
+            
+            size_t k = 0;
+            for (int i = tile.x0; i < tile.x1; ++i, ++p) {
+                for (int sample = 0; sample < count; ++sample) {
+                    const ray& r = out[0].rays[k++];
+                    auto focus_point = r.origin() + r.direction();
+                    for (int v = 0; v < views; ++v) {
+                        auto origin = r.origin() + (v - 0.5 * (views - 1)) * view_baseline * u;
+                        view_rays[v] = ray(origin, focus_point - origin, r.time());
+                        hits[v] = world.hit(view_rays[v], interval(0.001, infinity), recs[v]);
+                    }
+                    
+                    for (int v = 0; v < views; ++v) {
+                        color c(0,0,0);
+                        has_indirect[v] = false;
+                        ray scattered;
+                        color attenuation;
+                        if (!hits[v]) {
+                            c = background(view_rays[v]);
+                        } else if (scatter_material(*recs[v].mat, view_rays[v], recs[v], attenuation, scattered)) {
+                            int reuse = -1;
+                            if (view_share > 0 && recs[v].mat->kind == material_kind::lambertian) {
+                                diffuse_hits++;
+                                double distance = recs[v].t * view_rays[v].direction().length();
+                                double radius = view_share * pixel_size * distance / focus_dist;
+                                for (int m = 0; m < v && reuse < 0; ++m)
+                                    if (has_indirect[m] && recs[m].mat == recs[v].mat
+                                        && (recs[m].p - recs[v].p).length_squared() <= radius * radius
+                                        && dot(recs[m].normal, recs[v].normal) > 0.95)
+                                        reuse = m;
+                            }
+                            if (reuse >= 0) {
+                                shared_paths++;
+                                c = attenuation * indirect[reuse];
+                            } else {
+                                indirect[v] = ray_color(scattered, max_depth - 1, world);
+                                has_indirect[v] = recs[v].mat->kind == material_kind::lambertian;
+                                c = attenuation * indirect[v];
+                            }
+                        }
+                        out[v].sum[p] += c;
+                        out[v].luminance_sq[p] += luminance(c) * luminance(c);
+                    }
+                }
+            }
+        }
+    }
+    
+    static std::string view_path(const std::string& path, int view) {
+        // image.png -> image_view0.png
+        auto dot_at = path.rfind('.');
+        auto slash_at = path.rfind('/');
+        if (dot_at == std::string::npos || (slash_at != std::string::npos && dot_at < slash_at))
+            dot_at = path.size();
+        return path.substr(0, dot_at) + "_view" + std::to_string(view) + path.substr(dot_at);
+    }
+    
+    void stream_all(const framebuffer& image, image_stream& out) const {
+        int size = std::max(tile_size, 1);
+        for (int y0 = 0; y0 < image_height; y0 += size) {
+            int y = out.bottom_up() ? std::max(image_height - y0 - size, 0) : y0;
+            int end = out.bottom_up() ? image_height - y0 : std::min(y0 + size, image_height);
+            out.write_rows(image, y, end);
+        }
+    }
+    
+    struct surface_sample {
+        point3 p;
+        vec3   normal;
+        bool   hit;
+    };
+    
+    struct temporal_history {
+        // The previous temporal render: its accumulated radiance, the surface each pixel saw through its center, and
+        // the camera it was seen from.
+        int    width = 0, height = 0;
+        point3 center, pixel00_loc;
+        vec3   pixel_delta_u, pixel_delta_v, w;
+        double focus_dist = 0;
+        std::vector<color>          mean;
+        std::vector<double>         luminance_sq;   // mean of the squared sample luminance, for the noise estimate
+        std::vector<double>         samples;
+        std::vector<surface_sample> surfaces;
+    };
+    
+    temporal_history history;
+    uint64_t temporal_frame = 0;
+    
+    template <typename world_type>
+    std::vector<surface_sample> primary_surfaces(const world_type& world) const {
+        // One ray per pixel through its center at time 0: the depth (as a world position) and normal the history
+        // is reprojected and validated with. Rows are shared out to the render threads like tiles.
+        std::vector<surface_sample> surfaces(static_cast<size_t>(image_width) * image_height);
+        std::atomic<int> next_row(0);
+        auto work = [&]() {
+            for (int j = next_row++; j < image_height; j = next_row++) {
+                for (int i = 0; i < image_width; ++i) {
+                    auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
+                    hit_record rec;
+                    auto& s = surfaces[static_cast<size_t>(j) * image_width + i];
+                    s.hit = world.hit(ray(center, pixel_center - center, 0.0), interval(0.001, infinity), rec);
+                    s.p = rec.p;
+                    s.normal = rec.normal;
+                }
+            }
+        };
+        std::vector<std::thread> pool;
+        for (int k = 0; k < worker_count(); ++k)
+            pool.emplace_back(work);
+        for (auto& t : pool)
+            t.join();
+        return surfaces;
+    }
+    
+    bool reproject(const surface_sample& s, color& mean, double& luminance_sq, double& samples) const {
+        // Projects the surface point into the previous camera and blends the history of the (up to) four pixels
+        // around it that saw the same surface: their point within temporal_tolerance of the distance, and their
+        // normal within about 25 degrees. Moving objects fail the test, since the history saw them elsewhere.
+        // Metal and glass pass it although their radiance changes with the camera: over a frame's camera motion
+        // the history still beats a few fresh samples there.
+        if (!s.hit)
+            return false;
+        const auto& h = history;
+        auto d = s.p - h.center;
+        double z = dot(d, -h.w);
+        if (z <= 0)
+            return false;
+        auto on_plane = h.center + d * (h.focus_dist / z) - h.pixel00_loc;
+        double x = dot(on_plane, h.pixel_delta_u) / h.pixel_delta_u.length_squared();
+        double y = dot(on_plane, h.pixel_delta_v) / h.pixel_delta_v.length_squared();
+        int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(std::floor(y));
+        double tolerance = temporal_tolerance * (s.p - center).length();
+        
+        double total = 0;
+        mean = color(0,0,0);
+        luminance_sq = 0;
+        samples = 0;
+        for (int k = 0; k < 4; ++k) {
+            int i = x0 + (k & 1), j = y0 + (k >> 1);
+            if (i < 0 || j < 0 || i >= h.width || j >= h.height)
+                continue;
+            size_t index = static_cast<size_t>(j) * h.width + i;
+            const auto& old = h.surfaces[index];
+            if (!old.hit || (old.p - s.p).length() > tolerance || dot(old.normal, s.normal) < 0.9)
+                continue;
+            double weight = ((k & 1) ? x - x0 : 1 - (x - x0)) * ((k >> 1) ? y - y0 : 1 - (y - y0));
+            total += weight;
+            mean += weight * h.mean[index];
+            luminance_sq += weight * h.luminance_sq[index];
+            samples += weight * h.samples[index];
+        }
+        if (total < 0.25)   // mostly disoccluded: what is left is an edge, not the surface
+            return false;
+        mean /= total;
+        luminance_sq /= total;
+        samples /= total;
+        return true;
+    }
+    
+    template <typename world_type>
+    void render_temporal(const world_type& world) {
+        // Temporal accumulation for sequences of one camera (animation.h): once there is history, each frame traces
+        // only temporal_samples fresh samples per pixel and adds the previous frame's radiance where it is still
+        // valid, up to samples_per_pixel in all. Pixels whose surface was hidden, off screen or moved get the fresh
+        // samples alone. Single pass only: no checkpoints, progressive mode, streaming, tiles out or farm; modes_compatible()
+        // rejects them.
         initialize();
+        if (!writer)
+            writer = std::make_shared<image_writer>(encode_threads > 0 ? encode_threads : worker_count());
+        auto trace = [&](const image_tile& tile, int target, tile_buffer& out) {
+            trace_tile(world, tile, target, out);
+        };
         
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        // Every frame draws new random numbers: the same ones again would add nothing to the history.
+        sample_seed = mix_bits(++temporal_frame);
+        auto surfaces = primary_surfaces(world);
+        bool reuse = history.width == image_width && history.height == image_height;
+        int fresh_samples = reuse ? std::max(1, std::min(temporal_samples, samples_per_pixel)) : samples_per_pixel;
+        framebuffer fresh;
+        fresh.reset(image_width, image_height);
+        run_pass(fresh, fresh_samples, worker_count(), trace, nullptr);
         
-        uint8_t* pixels = new uint8_t[image_width * image_height * 3];
+        framebuffer image;
+        image.reset(image_width, image_height);
+        std::vector<color> mean(surfaces.size());
+        std::vector<double> luminance_sq(surfaces.size());
+        std::vector<double> samples(surfaces.size());
+        size_t reused = 0;
+        for (int j = 0; j < image_height; ++j) {
+            for (int i = 0; i < image_width; ++i) {
+                size_t index = static_cast<size_t>(j) * image_width + i;
+                color sum = fresh.average(i, j) * fresh_samples;
+                double sum_sq = fresh.luminance_sq(i, j);
+                double count = fresh_samples;
+                color old;
+                double old_luminance_sq, old_samples;
+                if (reuse && reproject(surfaces[index], old, old_luminance_sq, old_samples)) {
+                    double weight = std::min(old_samples, static_cast<double>(samples_per_pixel - fresh_samples));
+                    if (weight > 0) {
+                        sum += weight * old;
+                        sum_sq += weight * old_luminance_sq;
+                        count += weight;
+                        reused++;
+                    }
+                }
+                mean[index] = sum / count;
+                luminance_sq[index] = sum_sq / count;
+                samples[index] = count;
+                // The framebuffer counts whole samples: the blended count is rounded, with the sums scaled to it,
+                // so the mean and the per-sample variance the noise estimate sees are the blended ones.
+                auto whole = static_cast<uint32_t>(std::lround(count));
+                image.add(i, j, mean[index] * whole, whole, luminance_sq[index] * whole);
+            }
+        }
+        std::clog << "\rDone: " << fresh_samples << " fresh samples per pixel, history reused for "
+                  << 100.0 * reused / surfaces.size() << "% of the pixels.\n";
+        
+        if (temporal_check) {
+            framebuffer reference;
+            reference.reset(image_width, image_height);
+            sample_seed = mix_bits(~temporal_frame);
+            run_pass(reference, samples_per_pixel, worker_count(), trace, nullptr);
+            std::clog << "\rError against " << samples_per_pixel << " spp: RMSE " << image_rmse(image, reference)
+                      << " with history, " << image_rmse(fresh, reference) << " with the fresh samples alone.\n";
+        }
+        
+        history.width = image_width;
+        history.height = image_height;
+        history.center = center;
+        history.pixel00_loc = pixel00_loc;
+        history.pixel_delta_u = pixel_delta_u;
+        history.pixel_delta_v = pixel_delta_v;
+        history.w = w;
+        history.focus_dist = focus_dist;
+        history.mean.swap(mean);
+        history.luminance_sq.swap(luminance_sq);
+        history.samples.swap(samples);
+        history.surfaces.swap(surfaces);
+        
+        finish_image(image);
+        if (!writer_shared)
+            writer->drain();
+    }
+    
+    template <typename pass_function>
+    void render_progressive(framebuffer& image, pass_function trace_pass) {
+        // Passes of one sample per pixel over the whole image, so the image is complete (if noisy) after the first
+        // and improves evenly from there. Ends after samples_per_pixel passes, when the next pass would overrun
+        // time_budget, when the noise estimate reaches noise_target, or on SIGINT/SIGTERM (after the current row).
+        typedef std::chrono::steady_clock clock;
+        auto start = clock::now();
+        auto last_snapshot = start;
+        
+        stop_requested() = 0;
+        auto previous_int = std::signal(SIGINT, request_stop);
+        auto previous_term = std::signal(SIGTERM, request_stop);
+        
+        int target = samples_per_pixel;
+        for (int j = 0; j < image_height; ++j)
+            target = std::min(target, static_cast<int>(image.samples(0, j)));
+        
+        for (int passes = 1; target < samples_per_pixel && !stop_requested(); ++passes) {
+            auto pass_start = clock::now();
+            trace_pass(image, ++target, nullptr);
+            auto now = clock::now();
+            double pass_seconds = std::chrono::duration<double>(now - pass_start).count();
+            double elapsed = std::chrono::duration<double>(now - start).count();
+            
+            double noise = image_noise(image);
+            std::clog << "\rPass " << target << '/' << samples_per_pixel << ", noise " << noise
+                      << ", " << elapsed << " s      " << std::flush;
+            
+            if (noise_target > 0 && noise <= noise_target)
+                break;
+            if (time_budget > 0 && elapsed + pass_seconds > time_budget)
+                break;
+            
+            bool pass_due = snapshot_passes > 0 && passes % snapshot_passes == 0;
+            bool time_due = snapshot_seconds > 0
+                         && std::chrono::duration<double>(now - last_snapshot).count() >= snapshot_seconds;
+            if ((pass_due || time_due) && target < samples_per_pixel) {
+                finish_image(image);
+                last_snapshot = clock::now();
+            }
+        }
         
+        std::signal(SIGINT, previous_int);
+        std::signal(SIGTERM, previous_term);
+    }
+    
+    template <typename world_type>
+    void trace_tile(const world_type& world, const image_tile& tile, int target, tile_buffer& out) const {
         // 각 행은 왼쪽에서 오른쪽으로, 그 행들은 위에서 아래로 입력됨.
         // real world의 infinite resolution을 그대로 구현할 수는 없겠지만... 적어도 aliasing 현상을 완화하기 위해,
         // point sampling 대신 각 픽셀에 대해 여러 sample들의 평균을 내는 방식으로 동일한 효과를 구현할 것.
-        int idx = 0;
-        for (int j = 0; j < image_height; ++j) {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i) {
-                color pixel_color(0,0,0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                    ray r = get_ray(i,j);
-                    pixel_color += ray_color(r, max_depth, world);
+        size_t p = 0;
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            int first_sample, count;
+            if (!begin_span(out, tile, j, target, first_sample, count)) {
+                p += tile.x1 - tile.x0;
+                continue;
+            }
+            out.rays.clear();
+            (this->*scanline_rays)(j, tile.x0, tile.x1, first_sample, count, out.rays);
+            out.row_samples[j - tile.y0] = count;
+            
+            size_t k = 0;
+            for (int i = tile.x0; i < tile.x1; ++i, ++p) {
+                for (int sample = 0; sample < count; ++sample) {
+                    auto c = ray_color(out.rays[k++], max_depth, world);
+                    out.sum[p] += c;
+                    out.luminance_sq[p] += luminance(c) * luminance(c);
                 }
-                write_color(std::cout, pixel_color, samples_per_pixel, pixels, idx);
             }
         }
-        stbi_write_png("./TheNextWeek/result/01_bouncingspheres.png", image_width, image_height, 3, pixels, image_width * 3);
-        delete[] pixels;
+    }
+    
+    template <typename batch_world>
+    void trace_tile_batched(const batch_world& world, const image_tile& tile, int target, tile_buffer& out) const {
+        std::vector<color> radiance;    // one entry per path (pixel, sample) of the tile row
+        std::vector<ray_query> queries;
+        std::vector<color> throughput;
+        std::vector<int> path;
         
-        std::clog << "\rDone.                 \n";
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            int first_sample, count;
+            if (!begin_span(out, tile, j, target, first_sample, count))
+                continue;
+            out.rays.clear();
+            (this->*scanline_rays)(j, tile.x0, tile.x1, first_sample, count, out.rays);
+            out.row_samples[j - tile.y0] = count;
+            queries.clear();
+            throughput.clear();
+            path.clear();
+            radiance.assign(out.rays.size(), color(0,0,0));
+            for (size_t k = 0; k < out.rays.size(); k++) {
+                queries.push_back(ray_query(out.rays[k], interval(0.001, infinity)));
+                throughput.push_back(color(1,1,1));
+                path.push_back(static_cast<int>(k));
+            }
+            
+            // Paths still alive after max_depth bounces gather no light, as in ray_color().
+            for (int depth = max_depth; depth > 0 && !queries.empty(); --depth) {
+                world.trace(queries);
+                
+                size_t alive = 0;
+                for (size_t k = 0; k < queries.size(); k++) {
+                    const auto& q = queries[k];
+                    if (!q.hit) {
+                        radiance[path[k]] += throughput[k] * background(q.r);
+                        continue;
+                    }
+                    ray scattered;
+                    color attenuation;
+                    if (scatter_material(*q.rec.mat, q.r, q.rec, attenuation, scattered)) {
+                        throughput[alive] = throughput[k] * attenuation;
+                        path[alive] = path[k];
+                        queries[alive] = ray_query(scattered, interval(0.001, infinity));
+                        alive++;
+                    }
+                }
+                queries.resize(alive);
+                throughput.resize(alive);
+                path.resize(alive);
+            }
+            
+            size_t k = 0;
+            size_t p = static_cast<size_t>(j - tile.y0) * (tile.x1 - tile.x0);
+            for (int i = tile.x0; i < tile.x1; ++i, ++p) {
+                for (int sample = 0; sample < count; ++sample, ++k) {
+                    out.sum[p] += radiance[k];
+                    out.luminance_sq[p] += luminance(radiance[k]) * luminance(radiance[k]);
+                }
+            }
+        }
     }
     
-private:
-    int    image_height;   // Rendered image height
-    point3 center;         // Camera center
-    point3 pixel00_loc;    // Location of pixel 0,0
-    vec3   pixel_delta_u;  // Offset to pixel to the right
-    vec3   pixel_delta_v;  // Offset to pixel below
-    vec3   u, v, w;        // Camera frame basis vectors
-    vec3   defocus_disk_u;  // Defocus disk horizontal radius
-    vec3   defocus_disk_v;  // Defocus disk vertical radius
+    static void commit_tile(framebuffer& image, const image_tile& tile, const tile_buffer& buffer) {
+        size_t p = 0;
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            int count = buffer.row_samples[j - tile.y0];
+            for (int i = tile.x0; i < tile.x1; ++i, ++p)
+                if (count > 0)
+                    image.add(i, j, buffer.sum[p], count, buffer.luminance_sq[p]);
+        }
+    }
+    
+    static volatile std::sig_atomic_t& stop_requested() {
+        static volatile std::sig_atomic_t flag = 0;
+        return flag;
+    }
+    
+    static void request_stop(int) { stop_requested() = 1; }
+    
+    static double image_noise(const framebuffer& image) {
+        // RMS over the pixels of the relative standard error of their mean luminance.
+        // Near-black pixels are measured against 0.01 instead of their own mean, so they don't dominate.
+        double total = 0;
+        size_t n = 0;
+        for (int j = 0; j < image.height(); ++j) {
+            for (int i = 0; i < image.width(); ++i) {
+                double e = image.standard_error(i, j) / std::max(luminance(image.average(i, j)), 0.01);
+                total += e * e;
+                n++;
+            }
+        }
+        return n ? std::sqrt(total / n) : 0.0;
+    }
+    
+    static double image_rmse(const framebuffer& image, const framebuffer& reference) {
+        // Root mean square difference of the linear radiance, over all channels of all pixels.
+        double total = 0;
+        for (int j = 0; j < image.height(); ++j) {
+            for (int i = 0; i < image.width(); ++i) {
+                auto d = image.average(i, j) - reference.average(i, j);
+                total += dot(d, d);
+            }
+        }
+        return std::sqrt(total / (3.0 * image.pixel_count()));
+    }
+    
+    uint64_t sample_seed = 0;   // mixed into every span's seed; temporal renders change it per frame
+    
+    shared_ptr<image_writer> writer;    // created by the first render, shared by copies of the camera
+    bool writer_shared = false;         // set by share_writer(): the caller drains the writer, render() doesn't
+    
+    std::chrono::steady_clock::time_point last_checkpoint;
+    bool save_checkpoints = false;
+    
+    void begin_image(framebuffer& image) {
+        image.reset(image_width, image_height);
+        last_checkpoint = std::chrono::steady_clock::now();
+        save_checkpoints = !checkpoint_path.empty();
+        if (!resume || !save_checkpoints)
+            return;
+        if (image.read_checkpoint(checkpoint_path, job_key())) {
+            std::clog << "Resuming from " << checkpoint_path << ".\n";
+        } else if (access(checkpoint_path.c_str(), F_OK) == 0) {
+            // Whatever is there belongs to another render; don't replace it with this one.
+            std::clog << "Starting from zero samples, without checkpoints.\n";
+            save_checkpoints = false;
+        } else {
+            std::clog << "Starting from zero samples.\n";
+        }
+    }
+    
+    bool begin_span(const tile_buffer& out, const image_tile& tile, int j, int target, int& first_sample, int& count) const {
+        // Row j of the tile. Tiles are committed and checkpointed whole, so every pixel of the span has the same
+        // sample count, out.first_sample. Returns false when it already has `target` samples (a resumed or
+        // topped-up render), or when a progressive render was asked to stop.
+        // Otherwise seeds this thread's random numbers from the span and its first new sample index: the samples
+        // are the same whether or not the render was interrupted and on whichever thread, and a top-up draws new
+        // numbers, not the old ones again.
+        first_sample = out.first_sample[j - tile.y0];
+        count = target - first_sample;
+        if (count <= 0 || stop_requested())
+            return false;
+        seed_random(mix_bits(((static_cast<uint64_t>(j) << 32) | static_cast<uint32_t>(first_sample)) ^ mix_bits(tile.x0)
+                             ^ sample_seed));
+        return true;
+    }
+    
+    void checkpoint_if_due(const framebuffer& image) {
+        if (!save_checkpoints)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - last_checkpoint).count() < checkpoint_seconds)
+            return;
+        image.write_checkpoint(checkpoint_path, job_key());
+        last_checkpoint = now;
+    }
+    
+    void finish_image(const framebuffer& image, std::function<void(bool)> written = nullptr) const {
+        // The final checkpoint is what a later top-up (resume with a higher samples_per_pixel) starts from.
+        // Then the resolve pass: the PNG gets the tone-mapped 8-bit image, the optional PFM the radiance itself.
+        if (save_checkpoints)
+            image.write_checkpoint(checkpoint_path, job_key());
+        // The PNG is encoded by the writer's threads while rendering goes on; render_image waits for it at the end.
+        // Both are written under a temporary name and renamed, so a snapshot on disk is never half written.
+        write_image(image, output_path, hdr_path, std::move(written));
+    }
+    
+    void write_image(const framebuffer& image, const std::string& png_path, const std::string& pfm_path,
+                     std::function<void(bool)> written) const {
+        std::vector<uint8_t> pixels(image.pixel_count() * 3);
+        image.resolve(pixels.data(), tonemap);
+        writer->write_png(png_path, std::move(pixels), image_width, image_height, png_compression, std::move(written));
+        if (!pfm_path.empty() && image.write_pfm(pfm_path + ".tmp"))
+            std::rename((pfm_path + ".tmp").c_str(), pfm_path.c_str());
+    }
+    
+    uint64_t job_key() const {
+        // FNV-1a over everything that decides what a sample sees, except samples_per_pixel (top-ups change it).
+        // The scene is not part of it: resuming against a different scene is up to the caller.
+        // tile_size is: tiles are resumed whole (a tile row starts from the sample count of its first pixel), and
+        // the random numbers of a span depend on where its tile starts.
+        double settings[] = {
+            aspect_ratio, double(image_width), double(max_depth), vfov,
+            lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(), vup.x(), vup.y(), vup.z(),
+            defocus_angle, focus_dist, double(motion_blur), double(jitter), double(std::max(tile_size, 1))
+        };
+        const auto* bytes = reinterpret_cast<const unsigned char*>(settings);
+        uint64_t key = 0xcbf29ce484222325ULL;
+        for (size_t k = 0; k < sizeof(settings); k++)
+            key = (key ^ bytes[k]) * 0x100000001b3ULL;
+        return key;
+    }
     
     void initialize() {
         // Calculate the image height, and ensure that it's at least 1.
@@ -115,30 +1146,61 @@ private:
         auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
-    }
-    
-    ray get_ray(int i, int j) const {
-        // Get a randomly-sampled camera ray for the pixel at location i,j, originating from the camera defocus disk.
-        // 여기서는 P(0,0)을 기준으로 하여 각 pixel들의 center를 구하고, camera_center를 이용해 eye->sample로의 ray를 정의.
-        // ++) 카메라가 [0,1] 사이의 random instant(time)에서 ray를 생성하도록 함.
         
-        auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
-        auto pixel_sample = pixel_center + pixel_sample_square();
+        strata = static_cast<int>(std::sqrt(static_cast<double>(samples_per_pixel)));
+        strata = (strata < 1) ? 1 : strata;
+        inv_strata = 1.0 / strata;
         
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
-        auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
-
-        return ray(ray_origin, ray_direction, ray_time);
+        // Pick the ray generator once, so the per-sample loop has no feature checks and no unused random draws.
+        bool thin_lens = defocus_angle > 0;
+        if (thin_lens)
+            scanline_rays = motion_blur ? select_generator<true, true>() : select_generator<true, false>();
+        else
+            scanline_rays = motion_blur ? select_generator<false, true>() : select_generator<false, false>();
     }
     
-    vec3 pixel_sample_square() const {
-        // Returns a random point in the square surrounding a pixel at the origin.
-        // px = [-0.5,0.5), py = [-0.5,0.5)로 리턴하는 값은 pixel center를 둘러싸는 사각형 내의 offset 범위!
+    template <bool thin_lens, bool timed>
+    void (camera::*select_generator() const)(int, int, int, int, int, std::vector<ray>&) const {
+        switch (jitter) {
+            case jitter_stratified: return &camera::generate_scanline<thin_lens, timed, jitter_stratified>;
+            case jitter_none:       return &camera::generate_scanline<thin_lens, timed, jitter_none>;
+            default:                return &camera::generate_scanline<thin_lens, timed, jitter_random>;
+        }
+    }
+    
+    template <bool thin_lens, bool timed, jitter_mode pattern>
+    void generate_scanline(int j, int x0, int x1, int first_sample, int count, std::vector<ray>& rays) const {
+        // Get samples [first_sample, first_sample + count) of pixels [x0, x1) in row j, originating from the camera defocus disk.
+        // 여기서는 P(0,0)을 기준으로 하여 각 pixel들의 center를 구하고, camera_center를 이용해 eye->sample로의 ray를 정의.
+        // ++) 카메라가 [0,1] 사이의 random instant(time)에서 ray를 생성하도록 함. (motion blur가 꺼져 있으면 time 0)
+        // Samples are placed from the pixel's top-left corner: corner + rx * delta_u + ry * delta_v with rx, ry in [0,1),
+        // which is the same square around the pixel center as before. The corner advances by one add per pixel.
+        // The branches on template parameters are resolved at compile time.
         
-        auto px = -0.5 + random_double();
-        auto py = -0.5 + random_double();
-        return (px * pixel_delta_u) + (py * pixel_delta_v);
+        auto corner = pixel00_loc - 0.5 * (pixel_delta_u + pixel_delta_v) + x0 * pixel_delta_u + j * pixel_delta_v;
+        rays.reserve(rays.size() + static_cast<size_t>(x1 - x0) * count);
+        
+        for (int i = x0; i < x1; ++i, corner += pixel_delta_u) {
+            for (int sample = first_sample; sample < first_sample + count; ++sample) {
+                double rx, ry;
+                if (pattern == jitter_none) {
+                    rx = ry = 0.5;
+                } else if (pattern == jitter_stratified) {
+                    // Samples beyond strata^2 start another pass over the grid.
+                    int cell = sample % (strata * strata);
+                    rx = ((cell % strata) + random_double()) * inv_strata;
+                    ry = ((cell / strata) + random_double()) * inv_strata;
+                } else {
+                    rx = random_double();
+                    ry = random_double();
+                }
+                auto pixel_sample = corner + (rx * pixel_delta_u) + (ry * pixel_delta_v);
+                
+                auto ray_origin = thin_lens ? defocus_disk_sample() : center;
+                auto ray_time = timed ? random_double() : 0.0;
+                rays.push_back(ray(ray_origin, pixel_sample - ray_origin, ray_time));
+            }
+        }
     }
     
     point3 defocus_disk_sample() const {
@@ -153,7 +1215,8 @@ private:
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    template <typename world_type>
+    color ray_color(const ray& r, int depth, const world_type& world) const {
         // linearly blend white and blue depending on the height of the y coordinate.
         // to implement a simple gradient, use lerp.
         // blendedValue = (1-a) * startValue + a * endValue
@@ -179,11 +1242,15 @@ private:
         if (world.hit(r, interval(0.001, infinity), rec)) {
             ray scattered;
             color attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
+            if (scatter_material(*rec.mat, r, rec, attenuation, scattered))
                 return attenuation * ray_color(scattered, depth-1, world);
             return color(0,0,0);
         }
         
+        return background(r);
+    }
+    
+    color background(const ray& r) const {
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5 * (unit_direction.y() + 1.0);
         return (1.0-a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
@@ -30,30 +30,9 @@ inline double linear_to_gamma(double linear_component)
     return sqrt(linear_component);
 }
 
-void write_color(std::ostream &out, color pixel_color, int samples_per_pixel, uint8_t* pixels, int& idx) {
-    
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-    
-    // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
-    r *= scale;
-    g *= scale;
-    b *= scale;
-    
-    // Apply the linear to gamma transform.
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-    
-    // Write the translated [0,255] value of each color component.
-    // rgb 각 요소는 내부적으로 0.0~1.0 사이의 실수 값으로 나타내지만, 출력 전에 0~255 사이의 정수 값으로 변환되어야 함.
-    // ++) 이전처럼 pixel color에 255.999를 곱해 변환하는 대신 intensity의 max 범위를 0.999로 설정.
-    static const interval intensity(0.000, 0.999);
-    pixels[idx++] = static_cast<int>(256 * intensity.clamp(r));
-    pixels[idx++] = static_cast<int>(256 * intensity.clamp(g));
-    pixels[idx++] = static_cast<int>(256 * intensity.clamp(b));
+inline double luminance(const color& c) {
+    // Rec. 709 weights: how bright a linear color looks. Used for noise estimates, not for output.
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
 }
 
 #endif /* COLOR_H */
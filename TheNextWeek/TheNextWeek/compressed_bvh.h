@@ -0,0 +1,316 @@
+//
+//  compressed_bvh.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef COMPRESSED_BVH_H
+#define COMPRESSED_BVH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Primitive source for compressed_bvh over ordinary hittables.
+// compressed_bvh works with any type that offers the same three members:
+//     size_t size() const;
+//     aabb bounds(size_t i) const;
+//     bool hit(size_t i, const ray& r, interval ray_t, hit_record& rec) const;
+// With a final object type (object_set<sphere>), hit() is a direct call that inlines into the traversal.
+template <typename object>
+class object_set {
+public:
+    object_set() {}
+    object_set(const std::vector<shared_ptr<object>>& list) : objects(list) {}
+    object_set(const hittable_list& list) : objects(list.objects) {}    // object_set<hittable> only
+
+    size_t size() const { return objects.size(); }
+    aabb bounds(size_t i) const { return objects[i]->bounding_box(); }
+    bool hit(size_t i, const ray& r, interval ray_t, hit_record& rec) const { return objects[i]->hit(r, ray_t, rec); }
+
+private:
+    std::vector<shared_ptr<object>> objects;
+};
+
+using hittable_set = object_set<hittable>;
+
+// 20 bytes: both children's bounds as 8-bit offsets inside this node's own box, plus two child references.
+struct compressed_bvh_node {
+    uint8_t  lo[2][3];
+    uint8_t  hi[2][3];
+    uint32_t child[2];   // 0: empty, top bit clear: inner node index, top bit set: leaf (see leaf_ref)
+};
+
+static_assert(sizeof(compressed_bvh_node) == 20, "compressed_bvh_node should stay at 20 bytes");
+
+template <typename primitive_set>
+class compressed_bvh final : public hittable {
+public:
+    static const int max_leaf_size = 16;
+    static const size_t max_primitives = size_t(1) << 27;  // leaf references hold a 27-bit first index
+    static const int max_stack = 64;
+    static const int max_tree_depth = max_stack - 2;        // inner nodes below the root; see hit()
+
+    compressed_bvh(const primitive_set& primitive_source, int leaf_size = 4)
+        : primitives(primitive_source)
+    {
+        leaf_size = std::max(1, std::min(leaf_size, static_cast<int>(max_leaf_size)));
+
+        size_t n = primitives.size();
+        if (n > max_primitives) {
+            // Too many for the leaf encoding: the tree stays empty and built() says so, so the caller can fall
+            // back to bvh_node instead of rendering with corrupt leaf references.
+            std::clog << "Compressed BVH: " << n << " primitives, at most " << max_primitives << " supported.\n";
+            nodes.push_back(compressed_bvh_node());
+            return;
+        }
+        complete = true;
+        std::vector<build_item> items(n);
+        for (size_t i = 0; i < n; i++) {
+            items[i].box = primitives.bounds(i);
+            items[i].index = static_cast<uint32_t>(i);
+            bbox = aabb(bbox, items[i].box);
+        }
+
+        indices.reserve(n);
+        nodes.reserve(n / leaf_size + 2);
+        nodes.push_back(compressed_bvh_node());
+        int depth = 0;
+        if (n > 0)
+            build_node(0, bbox, items, 0, n, leaf_size, 0, depth);
+        nodes.shrink_to_fit();
+        if (depth > max_tree_depth) {
+            // Median splits halve every range, so this takes far more primitives than max_primitives allows;
+            // it is checked anyway, since hit() has no room to push children of nodes below this depth.
+            std::clog << "Compressed BVH: depth " << depth << ", at most " << max_tree_depth << " supported.\n";
+            complete = false;
+        }
+    }
+
+    bool built() const { return complete; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!complete || primitives.size() == 0 || !bbox.hit(r, ray_t))
+            return false;
+
+        const double orig[3] = { r.origin().x(), r.origin().y(), r.origin().z() };
+        const double inv_dir[3] = { 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() };
+
+        // Child boxes only exist relative to their parent, so each stack entry carries its node's decoded box.
+        struct entry { uint32_t node; aabb box; };
+        // Only inner children are pushed, at most two per popped node: the stack never holds more than one
+        // entry per level plus the two children of the deepest node, which max_tree_depth keeps within max_stack.
+        entry stack[max_stack];
+        int top = 0;
+        stack[top++] = { 0, bbox };
+
+        bool hit_anything = false;
+        while (top > 0) {
+            auto current = stack[--top];
+            const auto& node = nodes[current.node];
+
+            aabb child_box[2];
+            double t_enter[2];
+            bool visit[2];
+            for (int c = 0; c < 2; c++) {
+                visit[c] = node.child[c] != 0;
+                if (!visit[c])
+                    continue;
+                child_box[c] = decode(current.box, node, c);
+                visit[c] = slab_hit(child_box[c], orig, inv_dir, ray_t, t_enter[c]);
+            }
+
+            // Leaves are resolved right away, which may shrink ray_t before the inner children are pushed.
+            for (int c = 0; c < 2; c++) {
+                if (visit[c] && is_leaf(node.child[c])) {
+                    visit[c] = false;
+                    uint32_t first = leaf_first(node.child[c]);
+                    uint32_t count = leaf_count(node.child[c]);
+                    for (uint32_t i = first; i < first + count; i++) {
+                        if (primitives.hit(indices[i], r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                }
+            }
+
+            // Push the farther child first so the nearer one is traversed next.
+            int first = (visit[0] && visit[1] && t_enter[1] < t_enter[0]) ? 1 : 0;
+            for (int k = 1; k >= 0; k--) {
+                int c = k == 0 ? first : 1 - first;
+                if (visit[c])
+                    stack[top++] = { node.child[c], child_box[c] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t memory_bytes() const {
+        // Acceleration structure only: nodes plus the leaf-ordered primitive index array.
+        return nodes.size() * sizeof(compressed_bvh_node) + indices.size() * sizeof(uint32_t);
+    }
+
+private:
+    struct build_item {
+        aabb box;
+        uint32_t index;
+    };
+
+    primitive_set primitives;
+    std::vector<compressed_bvh_node> nodes;   // nodes[0] is the root; its box is bbox
+    std::vector<uint32_t> indices;
+    aabb bbox;
+    bool complete = false;
+
+    // Leaf reference: top bit set, 4 bits of (count-1), 27 bits of first index into `indices`.
+    static bool is_leaf(uint32_t ref) { return (ref & 0x80000000u) != 0; }
+    static uint32_t leaf_count(uint32_t ref) { return ((ref >> 27) & 0xF) + 1; }
+    static uint32_t leaf_first(uint32_t ref) { return ref & 0x07FFFFFFu; }
+    static uint32_t leaf_ref(size_t first, size_t count) {
+        return 0x80000000u | (static_cast<uint32_t>(count - 1) << 27) | static_cast<uint32_t>(first);
+    }
+
+    // Decoding must be bit-identical between build and traversal, so both go through these two functions.
+    // Code 255 maps to the parent's max exactly, so a child touching the parent's far face is never clipped.
+    static double dequantize(const interval& parent, uint8_t q) {
+        if (q == 255)
+            return parent.max;
+        return parent.min + q * ((parent.max - parent.min) / 255.0);
+    }
+
+    static aabb decode(const aabb& parent, const compressed_bvh_node& node, int c) {
+        return aabb(interval(dequantize(parent.x, node.lo[c][0]), dequantize(parent.x, node.hi[c][0])),
+                    interval(dequantize(parent.y, node.lo[c][1]), dequantize(parent.y, node.hi[c][1])),
+                    interval(dequantize(parent.z, node.lo[c][2]), dequantize(parent.z, node.hi[c][2])));
+    }
+
+    static void quantize(const interval& parent, const interval& child, uint8_t& lo, uint8_t& hi) {
+        // Conservative rounding: lo rounds down and hi rounds up, then both are nudged outward until the
+        // decoded interval really contains the child (the float math can land one step off).
+        double extent = parent.max - parent.min;
+        int qlo = 0, qhi = 255;
+        if (extent > 0) {
+            qlo = static_cast<int>(std::floor((child.min - parent.min) / extent * 255.0));
+            qhi = static_cast<int>(std::ceil((child.max - parent.min) / extent * 255.0));
+            qlo = std::max(0, std::min(qlo, 255));
+            qhi = std::max(qlo, std::min(qhi, 255));
+        }
+        while (qlo > 0 && dequantize(parent, static_cast<uint8_t>(qlo)) > child.min)
+            qlo--;
+        while (qhi < 255 && dequantize(parent, static_cast<uint8_t>(qhi)) < child.max)
+            qhi++;
+        lo = static_cast<uint8_t>(qlo);
+        hi = static_cast<uint8_t>(qhi);
+    }
+
+    static aabb range_box(const std::vector<build_item>& items, size_t start, size_t end) {
+        aabb box;
+        for (size_t i = start; i < end; i++)
+            box = aabb(box, items[i].box);
+        return box;
+    }
+
+    static double centroid(const aabb& box, int axis) {
+        return 0.5 * (box.axis(axis).min + box.axis(axis).max);
+    }
+
+    void build_node(uint32_t node_index, const aabb& node_box, std::vector<build_item>& items,
+                    size_t start, size_t end, int leaf_size, int depth, int& max_depth) {
+        // node_box is the *decoded* box the traversal will have for this node, not the exact bounds,
+        // so the children are quantized against exactly what the traversal will decode them with.
+        max_depth = std::max(max_depth, depth);
+        size_t span = end - start;
+        size_t ranges[2][2];
+        int child_count = 2;
+
+        if (span <= static_cast<size_t>(leaf_size) && node_index == 0) {
+            // Tiny scene: the root holds a single leaf.
+            ranges[0][0] = start;  ranges[0][1] = end;
+            child_count = 1;
+        } else {
+            aabb centroid_box;
+            for (size_t i = start; i < end; i++) {
+                auto c = point3(centroid(items[i].box, 0), centroid(items[i].box, 1), centroid(items[i].box, 2));
+                centroid_box = aabb(centroid_box, aabb(c, c));
+            }
+            int axis = 0;
+            if (centroid_box.y.size() > centroid_box.axis(axis).size()) axis = 1;
+            if (centroid_box.z.size() > centroid_box.axis(axis).size()) axis = 2;
+
+            auto mid = start + span/2;
+            std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                [axis](const build_item& a, const build_item& b) {
+                    return centroid(a.box, axis) < centroid(b.box, axis);
+                });
+            ranges[0][0] = start;  ranges[0][1] = mid;
+            ranges[1][0] = mid;    ranges[1][1] = end;
+        }
+
+        compressed_bvh_node node;
+        aabb child_boxes[2];
+        for (int c = 0; c < 2; c++) {
+            node.child[c] = 0;
+            for (int a = 0; a < 3; a++)
+                node.lo[c][a] = node.hi[c][a] = 0;
+            if (c >= child_count)
+                continue;
+
+            auto exact = range_box(items, ranges[c][0], ranges[c][1]);
+            for (int a = 0; a < 3; a++)
+                quantize(node_box.axis(a), exact.axis(a), node.lo[c][a], node.hi[c][a]);
+            child_boxes[c] = decode(node_box, node, c);
+        }
+
+        for (int c = 0; c < child_count; c++) {
+            size_t child_start = ranges[c][0], child_end = ranges[c][1];
+            if (child_end - child_start <= static_cast<size_t>(leaf_size)) {
+                node.child[c] = leaf_ref(indices.size(), child_end - child_start);
+                for (size_t i = child_start; i < child_end; i++)
+                    indices.push_back(items[i].index);
+            } else {
+                auto child_index = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(compressed_bvh_node());
+                node.child[c] = child_index;
+                nodes[node_index] = node;   // keep what's known so far; the recursive call may reallocate
+                build_node(child_index, child_boxes[c], items, child_start, child_end, leaf_size, depth + 1, max_depth);
+            }
+        }
+        nodes[node_index] = node;
+    }
+
+    static bool slab_hit(const aabb& box, const double* orig, const double* inv_dir, interval ray_t, double& t_enter) {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (box.axis(a).min - orig[a]) * inv_dir[a];
+            auto t1 = (box.axis(a).max - orig[a]) * inv_dir[a];
+            if (inv_dir[a] < 0)
+                std::swap(t0, t1);
+
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        t_enter = ray_t.min;
+        return true;
+    }
+};
+
+#endif /* COMPRESSED_BVH_H */
+
+// Note
+// bvh_node는 double aabb (48 bytes) + shared_ptr 두 개 (32 bytes) + vtable pointer로 node당 100 bytes 가까이 사용함.
+// 여기서는 child bounds를 parent box 안의 8-bit offset으로 저장해 node 하나가 20 bytes이고, leaf에는 primitive를 최대 16개까지 담음.
+// With 4-primitive leaves that is roughly 20/3 bytes of nodes plus 4 bytes of index per primitive, well under 20 bytes in total.
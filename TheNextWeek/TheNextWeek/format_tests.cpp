@@ -0,0 +1,505 @@
+//
+//  format_tests.cpp
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "paged_bvh.h"
+#include "render_farm.h"
+#include "scene_file.h"
+#include "tile_store.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Round trips of the binary formats the renderer writes by hand: PNG (the merged parallel zlib stream and
+// png_stream), .rtckpt, .rtscene, .rttree, .rttiles and the farm protocol's payloads. A wrong byte in any of them
+// produces files that other programs (or a later run) can't read, with no other signal.
+// Registered with ctest; prints one line per failed check and exits 1 if there was any.
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::printf("FAILED: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+static std::string temp_path(const char* name) {
+    return "/tmp/rt_format_tests_" + std::to_string(getpid()) + "_" + name;
+}
+
+static std::vector<unsigned char> read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<unsigned char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string& path, const std::vector<unsigned char>& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+static std::vector<uint8_t> test_image(int width, int height) {
+    // Smooth gradients (long matches, every filter useful) with noisy patches (literals).
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    for (int j = 0; j < height; ++j)
+        for (int i = 0; i < width; ++i)
+            for (int c = 0; c < 3; ++c) {
+                bool noisy = ((i / 17) + (j / 13)) % 3 == 0;
+                rgb[(static_cast<size_t>(j) * width + i) * 3 + c] =
+                    static_cast<uint8_t>(noisy ? random_int(0, 255) : (i * (c + 1) + j * 3) & 0xff);
+            }
+    return rgb;
+}
+
+
+// PNG
+
+static uint32_t big_endian(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static bool decode_png(const std::vector<unsigned char>& file, int width, int height, std::vector<uint8_t>& rgb,
+                       const std::string& what) {
+    // Checks the signature, every chunk CRC and the IHDR, inflates the concatenated IDATs with zlib (which also
+    // checks the Adler-32) and undoes the row filters.
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (file.size() < 8 || std::memcmp(file.data(), signature, 8) != 0) {
+        check(false, what + ": PNG signature");
+        return false;
+    }
+    std::vector<unsigned char> stream;
+    bool ended = false;
+    for (size_t at = 8; at < file.size() && !ended; ) {
+        if (file.size() - at < 12) {
+            check(false, what + ": truncated chunk");
+            return false;
+        }
+        uint32_t length = big_endian(&file[at]);
+        if (file.size() - at - 12 < length) {
+            check(false, what + ": chunk runs past the end");
+            return false;
+        }
+        const unsigned char* type = &file[at + 4];
+        const unsigned char* data = &file[at + 8];
+        if (png_detail::crc32(0, type, length + 4) != big_endian(data + length)) {
+            check(false, what + ": chunk CRC");
+            return false;
+        }
+        if (std::memcmp(type, "IHDR", 4) == 0)
+            check(length == 13 && big_endian(data) == uint32_t(width) && big_endian(data + 4) == uint32_t(height)
+                  && data[8] == 8 && data[9] == 2, what + ": IHDR");
+        else if (std::memcmp(type, "IDAT", 4) == 0)
+            stream.insert(stream.end(), data, data + length);
+        else if (std::memcmp(type, "IEND", 4) == 0)
+            ended = true;
+        at += 12 + length;
+    }
+    check(ended, what + ": IEND");
+
+    size_t stride = static_cast<size_t>(width) * 3;
+    std::vector<unsigned char> raw((stride + 1) * height);
+#ifdef RT_HAVE_ZLIB
+    uLongf raw_size = static_cast<uLongf>(raw.size());
+    int status = uncompress(raw.data(), &raw_size, stream.data(), static_cast<uLong>(stream.size()));
+    if (status != Z_OK || raw_size != raw.size()) {
+        check(false, what + ": zlib stream does not inflate to the image");
+        return false;
+    }
+#else
+    return false;
+#endif
+
+    rgb.assign(stride * height, 0);
+    for (int j = 0; j < height; ++j) {
+        const unsigned char* in = &raw[j * (stride + 1)];
+        uint8_t* row = &rgb[j * stride];
+        const uint8_t* up = j > 0 ? row - stride : nullptr;
+        for (size_t x = 0; x < stride; ++x) {
+            int a = x >= 3 ? row[x - 3] : 0;
+            int b = up ? up[x] : 0;
+            int c = (up && x >= 3) ? up[x - 3] : 0;
+            int predicted = in[0] == 1 ? a : in[0] == 2 ? b : in[0] == 3 ? (a + b) / 2
+                          : in[0] == 4 ? png_detail::paeth(a, b, c) : 0;
+            row[x] = static_cast<uint8_t>(in[1 + x] + predicted);
+        }
+        if (in[0] > 4) {
+            check(false, what + ": unknown filter type");
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_adler32() {
+    std::vector<unsigned char> data(200000);
+    for (auto& byte : data)
+        byte = static_cast<unsigned char>(random_int(0, 255));
+    for (size_t split : { size_t(0), size_t(1), size_t(5552), size_t(65521), size_t(100000), data.size() }) {
+        auto a = png_detail::adler32(data.data(), split);
+        auto b = png_detail::adler32(data.data() + split, data.size() - split);
+        check(png_detail::adler32_combine(a, b, data.size() - split) == png_detail::adler32(data.data(), data.size()),
+              "adler32_combine at " + std::to_string(split));
+    }
+#ifdef RT_HAVE_ZLIB
+    check(png_detail::adler32(data.data(), data.size()) == ::adler32(1, data.data(), static_cast<uInt>(data.size())),
+          "adler32 against zlib");
+    check(png_detail::crc32(0, data.data(), data.size()) == ::crc32(0, data.data(), static_cast<uInt>(data.size())),
+          "crc32 against zlib");
+#endif
+}
+
+static void test_png() {
+#ifndef RT_HAVE_ZLIB
+    std::printf("PNG round trips skipped: built without zlib.\n");
+#else
+    // image_writer splits at about 256 KB of filtered rows: 300 pixels wide is 291 rows per block, so 582 rows
+    // end exactly on a block boundary, 583 start a one-row block, and 1000 make four blocks.
+    const int sizes[][2] = { {1, 1}, {7, 3}, {300, 291}, {300, 582}, {300, 583}, {300, 1000}, {40000, 9} };
+    const png_level levels[] = { png_uncompressed, png_fast, png_default };
+    const char* level_names[] = { "uncompressed", "fast", "default" };
+    auto path = temp_path("image.png");
+
+    image_writer writer(4);
+    for (const auto& size : sizes) {
+        int width = size[0], height = size[1];
+        auto rgb = test_image(width, height);
+        for (int l = 0; l < 3; ++l) {
+            std::string what = "PNG " + std::to_string(width) + "x" + std::to_string(height) + " " + level_names[l];
+            bool written = false;
+            writer.write_png(path, rgb, width, height, levels[l], [&written](bool ok) { written = ok; });
+            writer.drain();
+            check(written, what + ": written");
+            std::vector<uint8_t> decoded;
+            if (decode_png(read_file(path), width, height, decoded, what))
+                check(decoded == rgb, what + ": pixels");
+
+            // png_stream, in bands of 50 rows (and one short band at the end).
+            what = "png_stream " + what.substr(4);
+            png_stream stream;
+            bool ok = stream.open(path, width, height, levels[l]);
+            for (int j = 0; ok && j < height; j += 50)
+                ok = stream.write_rows(&rgb[static_cast<size_t>(j) * width * 3], std::min(50, height - j));
+            ok = stream.close() && ok;
+            check(ok, what + ": written");
+            if (decode_png(read_file(path), width, height, decoded, what))
+                check(decoded == rgb, what + ": pixels");
+        }
+    }
+    std::remove(path.c_str());
+#endif
+}
+
+
+// Checkpoints and tile files
+
+static framebuffer test_framebuffer(int width, int height) {
+    framebuffer image(width, height);
+    for (int j = 0; j < height; ++j)
+        for (int i = 0; i < width; ++i)
+            image.add(i, j, color(random_double(), random_double(0, 10), random_double()), random_int(1, 64), random_double());
+    return image;
+}
+
+static bool same_pixels(const framebuffer& a, const framebuffer& b) {
+    if (a.width() != b.width() || a.height() != b.height())
+        return false;
+    for (int j = 0; j < a.height(); ++j)
+        for (int i = 0; i < a.width(); ++i) {
+            auto ca = a.average(i, j), cb = b.average(i, j);
+            if (a.samples(i, j) != b.samples(i, j) || a.luminance_sq(i, j) != b.luminance_sq(i, j)
+                || ca.x() != cb.x() || ca.y() != cb.y() || ca.z() != cb.z())
+                return false;
+        }
+    return true;
+}
+
+static void test_checkpoint() {
+    auto path = temp_path("image.rtckpt");
+    auto image = test_framebuffer(37, 21);
+    check(image.write_checkpoint(path, 1234), "checkpoint: written");
+
+    framebuffer restored(37, 21);
+    check(restored.read_checkpoint(path, 1234) && same_pixels(image, restored), "checkpoint: round trip");
+
+    framebuffer other(37, 21);
+    check(!other.read_checkpoint(path, 1235), "checkpoint: another job's key is rejected");
+    framebuffer smaller(36, 21);
+    check(!smaller.read_checkpoint(path, 1234), "checkpoint: another size is rejected");
+
+    auto bytes = read_file(path);
+    bytes.pop_back();
+    write_file(path, bytes);
+    check(!other.read_checkpoint(path, 1234), "checkpoint: a truncated file is rejected");
+    std::remove(path.c_str());
+}
+
+static void test_tile_store() {
+    auto path = temp_path("image.rttiles");
+    const int width = 50, height = 30, size = 16;
+    std::vector<std::vector<float>> tiles;
+    {
+        tile_store store;
+        check(store.open(path, width, height, size, 77, false), "tiles: created");
+        for (int index = 0; index < store.columns() * store.bands(); ++index) {
+            auto t = store.tile(index);
+            std::vector<float> rgb(static_cast<size_t>(t.x1 - t.x0) * (t.y1 - t.y0) * 3);
+            for (auto& v : rgb)
+                v = static_cast<float>(random_double(0, 4));
+            tiles.push_back(rgb);
+            if (index != 5)     // left unrendered
+                check(store.write_tile(index, rgb, 8), "tiles: tile " + std::to_string(index) + " written");
+        }
+    }
+
+    tile_store other;
+    check(!other.open(path, width, height, size, 78, true), "tiles: another job's key is rejected");
+
+    tile_store store;
+    check(store.open(path, width, height, size, 77, true), "tiles: reopened");
+    bool all_equal = true;
+    for (int band = 0; band < store.bands(); ++band) {
+        framebuffer rows;
+        check(store.read_band(band, rows), "tiles: band " + std::to_string(band) + " read");
+        for (int c = 0; c < store.columns(); ++c) {
+            int index = band * store.columns() + c;
+            auto t = store.tile(index);
+            check(store.samples(index) == (index == 5 ? 0u : 8u), "tiles: samples of tile " + std::to_string(index));
+            for (int j = t.y0; j < t.y1; ++j)
+                for (int i = t.x0; i < t.x1; ++i) {
+                    const float* p = &tiles[index][(static_cast<size_t>(j - t.y0) * (t.x1 - t.x0) + (i - t.x0)) * 3];
+                    auto v = rows.average(i, j - t.y0);
+                    bool expected = index == 5 ? v.x() == 0 && v.y() == 0 && v.z() == 0
+                                               : v.x() == p[0] && v.y() == p[1] && v.z() == p[2];
+                    all_equal = all_equal && expected;
+                }
+        }
+    }
+    check(all_equal, "tiles: pixels");
+    std::remove(path.c_str());
+}
+
+
+// Scene files
+
+static scene_data test_scene(int count) {
+    scene_data scene;
+    auto diffuse = scene.add_material(scene_material_lambertian, color(0.3, 0.6, 0.9));
+    auto shiny = scene.add_material(scene_material_metal, color(0.8, 0.8, 0.8), 0.1);
+    for (int k = 0; k < count; ++k) {
+        auto center = point3(random_double(-20, 20), random_double(-20, 20), random_double(-20, 20));
+        if (k % 3 == 0)
+            scene.add_sphere(center, center + vec3(0, random_double(0, 1), 0), random_double(0.1, 1), diffuse);
+        else
+            scene.add_sphere(center, random_double(0.1, 1), k % 2 ? diffuse : shiny);
+    }
+    scene.camera.image_width = 123;
+    scene.camera.lookfrom[0] = 7;
+    return scene;
+}
+
+static std::vector<ray> test_rays(int count) {
+    std::vector<ray> rays;
+    for (int k = 0; k < count; ++k)
+        rays.push_back(ray(point3(0, 0, -40) + 5 * random_in_unit_sphere(), unit_vector(vec3::random(-0.6, 0.6) + vec3(0, 0, 1)),
+                           random_double()));
+    return rays;
+}
+
+static bool brute_force_hit(const std::vector<scene_sphere_record>& spheres, const ray& r, hit_record& rec) {
+    interval ray_t(0.001, infinity);
+    bool hit = false;
+    for (const auto& s : spheres)
+        if (hit_sphere_record(s, r, ray_t, rec)) {
+            ray_t.max = rec.t;
+            hit = true;
+        }
+    return hit;
+}
+
+template <typename hit_function>
+static void check_hits(const std::vector<scene_sphere_record>& spheres, const std::vector<ray>& rays,
+                       hit_function hit, const std::string& what) {
+    int mismatches = 0, hits = 0;
+    for (const auto& r : rays) {
+        hit_record expected, got;
+        bool e = brute_force_hit(spheres, r, expected);
+        bool g = hit(r, got);
+        hits += e;
+        if (e != g || (e && expected.t != got.t))
+            mismatches++;
+    }
+    check(hits > 0, what + ": the test rays hit something");
+    check(mismatches == 0, what + ": " + std::to_string(mismatches) + " rays disagree with a brute force search");
+}
+
+static void test_scene_file() {
+    auto path = temp_path("scene.rtscene");
+    auto scene = test_scene(2000);
+    scene.build_bvh();
+    check(scene.write(path), "rtscene: written");
+    auto records = scene.sphere_records();
+    auto rays = test_rays(5000);
+
+    {
+        flat_scene world;
+        check(world.open(path), "rtscene: opened");
+        check(world.size() == records.size() && world.camera_settings().image_width == 123
+              && world.camera_settings().lookfrom[0] == 7, "rtscene: counts and camera");
+        check_hits(records, rays, [&world](const ray& r, hit_record& rec) {
+            return world.hit(r, interval(0.001, infinity), rec);
+        }, "rtscene");
+    }
+
+    // A right child pointing back at its parent would loop; open() must refuse it.
+    auto bytes = read_file(path);
+    scene_file_header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    scene_bvh_record root;
+    std::memcpy(&root, &bytes[header.node_offset], sizeof(root));
+    root.offset = 0;
+    std::memcpy(&bytes[header.node_offset], &root, sizeof(root));
+    write_file(path, bytes);
+    flat_scene damaged;
+    check(!damaged.open(path), "rtscene: a BVH cycle is rejected");
+
+    bytes.resize(bytes.size() - 1);
+    write_file(path, bytes);
+    check(!damaged.open(path), "rtscene: a truncated file is rejected");
+    std::remove(path.c_str());
+}
+
+static void test_treelets() {
+    auto path = temp_path("scene.rttree");
+    auto scene = test_scene(3000);
+    scene.build_bvh();
+    check(write_paged_bvh(scene, path, 4096), "rttree: written");
+    auto records = scene.sphere_records();
+    auto rays = test_rays(5000);
+
+    {
+        // A cache smaller than the file, so pages are evicted and mapped again while tracing.
+        paged_bvh world;
+        check(world.open(path, 8 * 4096), "rttree: opened");
+        check(world.treelet_count() > 8, "rttree: several treelets");
+        check_hits(records, rays, [&world](const ray& r, hit_record& rec) {
+            return world.hit(r, interval(0.001, infinity), rec);
+        }, "rttree hit");
+
+        std::vector<ray_query> queries;
+        for (const auto& r : rays)
+            queries.push_back(ray_query(r, interval(0.001, infinity)));
+        world.trace(queries);
+        size_t k = 0;
+        check_hits(records, rays, [&queries, &k](const ray&, hit_record& rec) {
+            rec = queries[k].rec;
+            return queries[k++].hit;
+        }, "rttree trace");
+        check(world.page_evictions() > 0, "rttree: pages were evicted");
+    }
+
+    // A link from the root treelet back to itself would loop between pages; open() must refuse it.
+    auto bytes = read_file(path);
+    paged_bvh_header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    auto* page = &bytes[header.treelet_offset];
+    paged_bvh_page_header page_header;
+    std::memcpy(&page_header, page, sizeof(page_header));
+    bool relinked = false;
+    for (uint32_t i = 0; i < page_header.node_count && !relinked; ++i) {
+        scene_bvh_record node;
+        auto* at = page + sizeof(page_header) + i * sizeof(node);
+        std::memcpy(&node, at, sizeof(node));
+        if (node.count == paged_bvh_link) {
+            node.offset = 0;
+            std::memcpy(at, &node, sizeof(node));
+            relinked = true;
+        }
+    }
+    check(relinked, "rttree: the root treelet has links");
+    write_file(path, bytes);
+    paged_bvh damaged;
+    check(!damaged.open(path), "rttree: a link cycle is rejected");
+    std::remove(path.c_str());
+}
+
+
+// Farm protocol
+
+static void test_farm_payloads() {
+    farm_work result;
+    result.id = 42;
+    result.tile = image_tile{16, 32, 19, 34};
+    result.target = 100;
+    result.rows = {7, 9};
+    for (int k = 0; k < 3 * 2 * 4; ++k)
+        result.values.push_back(random_double());
+    auto payload = farm_detail::encode(result);
+
+    farm_work decoded;
+    check(farm_detail::decode(payload.data(), payload.size(), true, decoded) && decoded.id == 42
+          && decoded.tile.x0 == 16 && decoded.tile.y1 == 34 && decoded.target == 100
+          && decoded.rows == result.rows && decoded.values == result.values, "farm: result round trip");
+
+    for (size_t n = 0; n < payload.size(); ++n)
+        if (farm_detail::decode(payload.data(), n, true, decoded)) {
+            check(false, "farm: a payload truncated to " + std::to_string(n) + " bytes is accepted");
+            break;
+        }
+    auto longer = payload;
+    longer.push_back(0);
+    check(!farm_detail::decode(longer.data(), longer.size(), true, decoded), "farm: an oversized payload is rejected");
+    check(!farm_detail::decode(payload.data(), payload.size(), false, decoded), "farm: values where none belong");
+
+    // Tiles whose size overflows int, or whose value count would wrap size_t.
+    const int32_t corners[][4] = { {-2147483647 - 1, 0, 2147483647, 2}, {0, -2147483647 - 1, 3, 2147483647},
+                                   {0, 0, 2147483647, 2147483647}, {5, 0, 5, 2}, {0, 3, 2, 1} };
+    for (const auto& c : corners) {
+        auto bad = result;
+        bad.tile = image_tile{c[0], c[1], c[2], c[3]};
+        auto bytes = farm_detail::encode(bad);
+        check(!farm_detail::decode(bytes.data(), bytes.size(), true, decoded),
+              "farm: tile " + std::to_string(c[0]) + "," + std::to_string(c[1]) + " - "
+              + std::to_string(c[2]) + "," + std::to_string(c[3]) + " is rejected");
+    }
+
+    farm_work unit;
+    unit.id = 3;
+    unit.tile = image_tile{0, 0, 64, 1};
+    unit.target = 4;
+    unit.rows = {2};
+    payload = farm_detail::encode(unit);
+    check(farm_detail::decode(payload.data(), payload.size(), false, decoded) && decoded.rows == unit.rows
+          && decoded.values.empty(), "farm: unit round trip");
+}
+
+int main() {
+    seed_random(1);
+    test_adler32();
+    test_png();
+    test_checkpoint();
+    test_tile_store();
+    test_scene_file();
+    test_treelets();
+    test_farm_payloads();
+
+    if (failures > 0) {
+        std::printf("%d checks failed.\n", failures);
+        return 1;
+    }
+    std::printf("All format checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,303 @@
+//
+//  framebuffer.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum tone_curve {
+    tone_clamp,      // clip at 1, what write_color always did
+    tone_reinhard,   // c / (1 + c): highlights roll off instead of clipping
+};
+
+struct image_tile {
+    // A rectangle of pixels [x0, x1) x [y0, y1), the unit of work of the tiled renderer.
+    int x0, y0, x1, y1;
+};
+
+struct resolve_settings {
+    double     exposure = 0;            // in stops: every channel is scaled by 2^exposure before the tone curve
+    tone_curve curve    = tone_clamp;
+};
+
+// Checkpoint file (.rtckpt): the accumulation state of a framebuffer, so an interrupted render can resume and a
+// finished one can take more samples. Header, then the r, g, b and luminance^2 planes (double) and the sample counts (uint32),
+// each section 64-byte aligned. Counts are also the sample index state: the renderer seeds its random numbers from
+// (row, first sample index), so resumed samples continue the sequence instead of repeating the first ones.
+static const char framebuffer_checkpoint_magic[8] = {'R','T','C','K','P','T','\0','\0'};
+static const uint32_t framebuffer_checkpoint_version = 2;
+
+struct framebuffer_checkpoint_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint64_t job_key;         // fingerprint of the camera settings; a checkpoint only resumes the same view
+    uint64_t plane_offset;    // r plane; g, b, lum2 and count follow, each aligned
+    uint64_t plane_stride;    // bytes from one double plane to the next
+    uint64_t count_offset;
+    uint64_t file_size;
+};
+
+class framebuffer {
+public:
+    // Linear radiance accumulation for an image: per-pixel RGB sums in double and the number of samples in each.
+    // The sum of squared sample luminances is kept too, for a per-pixel variance (noise) estimate.
+    // The render loop only adds to it. Turning sums into displayable 8-bit values (average, exposure, tone curve,
+    // gamma, quantization) is the separate resolve pass, so the radiance itself is never lost and can be
+    // re-resolved or written as HDR (PFM) from the same render.
+    // Channels are stored as separate planes (SoA) so resolve runs over contiguous arrays.
+
+    framebuffer() {}
+    framebuffer(int width, int height) { reset(width, height); }
+
+    void reset(int width, int height) {
+        w = width;
+        h = height;
+        size_t n = static_cast<size_t>(w) * h;
+        r.assign(n, 0.0);
+        g.assign(n, 0.0);
+        b.assign(n, 0.0);
+        lum2.assign(n, 0.0);
+        count.assign(n, 0);
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+    size_t pixel_count() const { return count.size(); }
+
+    void add(int i, int j, const color& sum, uint32_t samples, double luminance_sq) {
+        // Adds `samples` samples whose radiance totals `sum` to pixel (i, j); luminance_sq is the sum of
+        // luminance(sample)^2 over the same samples.
+        size_t p = static_cast<size_t>(j) * w + i;
+        r[p] += sum.x();
+        g[p] += sum.y();
+        b[p] += sum.z();
+        lum2[p] += luminance_sq;
+        count[p] += samples;
+    }
+
+    color average(int i, int j) const {
+        size_t p = static_cast<size_t>(j) * w + i;
+        double scale = count[p] ? 1.0 / count[p] : 0.0;
+        return color(r[p] * scale, g[p] * scale, b[p] * scale);
+    }
+
+    uint32_t samples(int i, int j) const { return count[static_cast<size_t>(j) * w + i]; }
+    double luminance_sq(int i, int j) const { return lum2[static_cast<size_t>(j) * w + i]; }
+    
+    double standard_error(int i, int j) const {
+        // Estimated standard deviation of the pixel's mean luminance: sqrt(sample variance / n).
+        // Infinite below two samples, where there is no estimate yet.
+        size_t p = static_cast<size_t>(j) * w + i;
+        double n = count[p];
+        if (n < 2)
+            return infinity;
+        double mean = luminance(color(r[p], g[p], b[p])) / n;
+        double variance = std::max(lum2[p] / n - mean * mean, 0.0) * n / (n - 1);
+        return std::sqrt(variance / n);
+    }
+
+    void resolve(uint8_t* rgb, const resolve_settings& settings = resolve_settings()) const {
+        resolve_rows(0, h, rgb, settings);
+    }
+
+    void resolve_rows(int first_row, int end_row, uint8_t* rgb, const resolve_settings& settings = resolve_settings()) const {
+        // Writes 8-bit RGB for rows [first_row, end_row) into rgb, which starts at first_row.
+        // The tone curve is chosen once outside the per-pixel loop. The pass costs a few operations per pixel,
+        // nothing next to the samples that filled it, so it can be re-run whenever the settings change.
+        // rgb 각 요소는 내부적으로 0.0~1.0 사이의 실수 값이지만, 출력 전에 [0,255] 정수로 변환되어야 함. (intensity의 max는 0.999)
+        // Gamma is the same "gamma 2" approximation as linear_to_gamma().
+        size_t begin = static_cast<size_t>(first_row) * w;
+        size_t end = static_cast<size_t>(end_row) * w;
+        double scale = std::exp2(settings.exposure);
+        if (settings.curve == tone_reinhard)
+            resolve_span<true>(begin, end, scale, rgb);
+        else
+            resolve_span<false>(begin, end, scale, rgb);
+    }
+
+    void float_row(int j, float* rgb) const {
+        // Row j as averaged linear float RGB, the PFM pixel format.
+        for (int i = 0; i < w; ++i) {
+            auto c = average(i, j);
+            rgb[3*i] = static_cast<float>(c.x());
+            rgb[3*i + 1] = static_cast<float>(c.y());
+            rgb[3*i + 2] = static_cast<float>(c.z());
+        }
+    }
+
+    bool write_pfm(const std::string& path) const {
+        // Portable float map: the averaged linear radiance as 32-bit float RGB, bottom row first ("-1" = little endian).
+        // OpenEXR and most HDR tools read it; no tone curve or gamma is applied.
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f) {
+            std::clog << "Cannot open " << path << " for writing.\n";
+            return false;
+        }
+        bool ok = std::fprintf(f, "PF\n%d %d\n-1.0\n", w, h) > 0;
+        std::vector<float> row(static_cast<size_t>(w) * 3);
+        for (int j = h - 1; ok && j >= 0; --j) {
+            float_row(j, row.data());
+            ok = std::fwrite(row.data(), sizeof(float), row.size(), f) == row.size();
+        }
+        ok = (std::fclose(f) == 0) && ok;
+        if (!ok)
+            std::clog << "Failed to write " << path << ".\n";
+        return ok;
+    }
+
+    bool write_checkpoint(const std::string& path, uint64_t job_key) const {
+        // The file is sized and filled through a shared mapping under a temporary name, flushed, and renamed over
+        // the previous checkpoint: a kill at any point leaves either the old or the new state, never a torn one.
+        framebuffer_checkpoint_header header;
+        layout(header, job_key);
+        
+        std::string tmp_path = path + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::clog << "Cannot open " << tmp_path << " for writing.\n";
+            return false;
+        }
+        bool ok = ftruncate(fd, static_cast<off_t>(header.file_size)) == 0;
+        void* mapping = ok ? mmap(nullptr, header.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (mapping != MAP_FAILED) {
+            auto* base = static_cast<unsigned char*>(mapping);
+            size_t n = pixel_count();
+            std::memcpy(base, &header, sizeof(header));
+            std::memcpy(base + header.plane_offset, r.data(), n * sizeof(double));
+            std::memcpy(base + header.plane_offset + header.plane_stride, g.data(), n * sizeof(double));
+            std::memcpy(base + header.plane_offset + 2 * header.plane_stride, b.data(), n * sizeof(double));
+            std::memcpy(base + header.plane_offset + 3 * header.plane_stride, lum2.data(), n * sizeof(double));
+            std::memcpy(base + header.count_offset, count.data(), n * sizeof(uint32_t));
+            ok = msync(mapping, header.file_size, MS_SYNC) == 0;
+            munmap(mapping, header.file_size);
+        } else {
+            ok = false;
+        }
+        ok = (::close(fd) == 0) && ok;
+        
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::clog << "Failed to write checkpoint " << path << ".\n";
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+    
+    bool read_checkpoint(const std::string& path, uint64_t job_key) {
+        // Replaces the contents with a checkpoint of the same size and job. On failure the framebuffer is unchanged.
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::clog << "Cannot open checkpoint " << path << ".\n";
+            return false;
+        }
+        struct stat st;
+        framebuffer_checkpoint_header expected;
+        layout(expected, job_key);
+        if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != expected.file_size) {
+            std::clog << "Checkpoint " << path << " does not match a " << w << 'x' << h << " image.\n";
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, expected.file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            std::clog << "Cannot map checkpoint " << path << ".\n";
+            return false;
+        }
+        
+        const auto* base = static_cast<const unsigned char*>(mapping);
+        bool ok = std::memcmp(base, &expected, sizeof(expected)) == 0;
+        if (ok) {
+            size_t n = pixel_count();
+            std::memcpy(r.data(), base + expected.plane_offset, n * sizeof(double));
+            std::memcpy(g.data(), base + expected.plane_offset + expected.plane_stride, n * sizeof(double));
+            std::memcpy(b.data(), base + expected.plane_offset + 2 * expected.plane_stride, n * sizeof(double));
+            std::memcpy(lum2.data(), base + expected.plane_offset + 3 * expected.plane_stride, n * sizeof(double));
+            std::memcpy(count.data(), base + expected.count_offset, n * sizeof(uint32_t));
+        } else {
+            std::clog << "Checkpoint " << path << " belongs to a different render (or format version).\n";
+        }
+        munmap(mapping, expected.file_size);
+        return ok;
+    }
+    
+private:
+    int w = 0, h = 0;
+    std::vector<double> r, g, b, lum2;
+    std::vector<uint32_t> count;
+
+    void layout(framebuffer_checkpoint_header& header, uint64_t job_key) const {
+        // Fills every field, padding included, so headers can be compared bytewise.
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, framebuffer_checkpoint_magic, sizeof(header.magic));
+        header.version = framebuffer_checkpoint_version;
+        header.header_size = sizeof(framebuffer_checkpoint_header);
+        header.width = static_cast<uint32_t>(w);
+        header.height = static_cast<uint32_t>(h);
+        header.job_key = job_key;
+        
+        auto align = [](uint64_t offset) { return (offset + 63) & ~uint64_t(63); };
+        header.plane_offset = align(sizeof(framebuffer_checkpoint_header));
+        header.plane_stride = align(pixel_count() * sizeof(double));
+        header.count_offset = header.plane_offset + 4 * header.plane_stride;
+        header.file_size = header.count_offset + pixel_count() * sizeof(uint32_t);
+    }
+    
+    template <bool reinhard>
+    static uint8_t quantize(double v) {
+        // Clamping the integer is the same as clamping intensity to 0.999 first. Radiance is never negative.
+        if (reinhard)
+            v = v / (1 + v);
+        int q = static_cast<int>(256 * sqrt(v));
+        return static_cast<uint8_t>(std::min(std::max(q, 0), 255));
+    }
+
+    template <bool reinhard>
+    void resolve_span(size_t begin, size_t end, double exposure_scale, uint8_t* rgb) const {
+        // The plane pointers are loaded once: rgb is a byte pointer that may alias anything,
+        // so reading them through the vectors would reload them after every store.
+        const double* pr = r.data();
+        const double* pg = g.data();
+        const double* pb = b.data();
+        const uint32_t* pn = count.data();
+        for (size_t p = begin; p < end; p++) {
+            // An unsampled pixel has zero sums, so dividing by max(count, 1) leaves it black.
+            double scale = exposure_scale / std::max(pn[p], 1u);
+            uint8_t* out = rgb + 3 * (p - begin);
+            out[0] = quantize<reinhard>(pr[p] * scale);
+            out[1] = quantize<reinhard>(pg[p] * scale);
+            out[2] = quantize<reinhard>(pb[p] * scale);
+        }
+    }
+};
+
+#endif /* FRAMEBUFFER_H */
+
+// Note
+// 예전의 write_color는 sample을 다 모으자마자 scale, gamma correction, 8-bit quantization을 한 번에 해서 radiance 정보가 사라졌음.
+// framebuffer는 linear radiance의 합과 sample 수만 저장하고, 화면용 변환은 resolve에서 따로 함.
+// So more samples can be added later, the exposure can be changed without rendering again, and the HDR data can be saved as PFM.
+// checkpoint 파일은 이 accumulation state를 그대로 저장한 것. resume은 남은 sample만, top-up은 늘어난 spp 만큼의 새 sample만 렌더링함.
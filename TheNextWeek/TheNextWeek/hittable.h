@@ -18,7 +18,7 @@ class material;
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;   // when hit surface, point material pointer.
+    const material* mat;        // when hit surface, point material pointer. (non-owning, the scene keeps materials alive)
     double t;
     bool front_face;
     
@@ -35,6 +35,17 @@ struct hit_record {
     }
 };
 
+struct ray_query {
+    // One ray of a batch, for hittables that trace many rays at once (paged_bvh::trace).
+    ray r;
+    interval ray_t;
+    hit_record rec;
+    bool hit = false;
+    
+    ray_query() {}
+    ray_query(const ray& r, interval ray_t) : r(r), ray_t(ray_t) {}
+};
+
 class hittable {
 public:
     virtual ~hittable() = default;
@@ -0,0 +1,88 @@
+//
+//  image_stream.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+enum stream_format {
+    stream_none,
+    stream_ppm,     // binary PPM (P6): tone-mapped 8-bit RGB, top row first
+    stream_pfm,     // PFM: linear float RGB, bottom row first
+};
+
+class image_stream {
+public:
+    // Writes an image to a FILE (normally stdout) a band of rows at a time, in file order, while the rest of the
+    // image is still being rendered. The caller hands over rows in the order the format stores them
+    // (bottom_up() tells which), and each call becomes one large fwrite of the whole band plus a flush,
+    // so a reader at the other end of a pipe sees complete rows as soon as they exist.
+
+    image_stream(FILE* out, stream_format format, const resolve_settings& settings)
+      : out(out), format(format), settings(settings) {}
+
+    bool bottom_up() const { return format == stream_pfm; }
+
+    bool begin(int width, int height) {
+        w = width;
+        char header[64];
+        int n = (format == stream_pfm) ? std::snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height)
+                                       : std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+        buffer.assign(header, header + n);
+        return flush();
+    }
+
+    bool write_rows(const framebuffer& image, int first_row, int end_row) {
+        // Rows [first_row, end_row), emitted top to bottom for PPM and bottom to top for PFM.
+        size_t row_bytes = (format == stream_pfm) ? w * 3 * sizeof(float) : w * 3;
+        size_t start = buffer.size();
+        buffer.resize(start + row_bytes * (end_row - first_row));
+        unsigned char* dst = buffer.data() + start;
+        if (format == stream_pfm) {
+            std::vector<float> row(static_cast<size_t>(w) * 3);
+            for (int j = end_row - 1; j >= first_row; --j, dst += row_bytes) {
+                image.float_row(j, row.data());
+                std::memcpy(dst, row.data(), row_bytes);
+            }
+        } else {
+            image.resolve_rows(first_row, end_row, dst, settings);
+        }
+        return flush();
+    }
+
+private:
+    FILE* out;
+    stream_format format;
+    resolve_settings settings;
+    int w = 0;
+    std::vector<unsigned char> buffer;
+    bool failed = false;
+
+    bool flush() {
+        if (!failed && !buffer.empty()) {
+            failed = std::fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size() || std::fflush(out) != 0;
+            if (failed)
+                std::clog << "Image stream write failed; the rest of the image is dropped.\n";
+        }
+        buffer.clear();
+        return !failed;
+    }
+};
+
+#endif /* IMAGE_STREAM_H */
+
+// Note
+// 예전에는 P3 header만 stdout에 쓰고 pixel data는 없었음. (write_color가 PNG buffer만 채웠기 때문)
+// 여기서는 완성된 row band를 file 순서대로 바로 내보내서, 다른 tool이 렌더링이 끝나기 전에 이미지를 읽기 시작할 수 있음.
+// PFM은 아래 row부터 저장되므로 renderer가 tile band를 아래에서부터 처리하도록 함.
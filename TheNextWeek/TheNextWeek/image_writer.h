@@ -0,0 +1,564 @@
+//
+//  image_writer.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef RT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "stb_image_write.h"
+
+#ifndef RT_HAVE_ZLIB
+// Defined by stb_image_write's implementation, but not declared in its header part.
+STBIWDEF unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+#endif
+
+enum png_level {
+    png_uncompressed,   // stored deflate blocks: no compression work at all, 3 bytes per pixel on disk
+    png_fast,           // zlib level 1
+    png_default,        // zlib level 6
+};
+
+// PNG encoding split into blocks of rows that are filtered and deflated independently, then merged into one zlib
+// stream (the way pigz does it): every block but the last ends on a byte boundary with a sync flush, each block is
+// primed with the 32 KB of filtered data before it, and the per-block Adler-32 checksums are combined.
+// Built with RT_HAVE_ZLIB (CMakeLists.txt sets it when zlib is found); without it compressed images fall back to
+// stb's single-threaded compressor, and only png_uncompressed is split.
+
+namespace png_detail {
+
+inline uint32_t crc32(uint32_t crc, const unsigned char* data, size_t n) {
+    static uint32_t table[256];
+    static std::once_flag filled;
+    std::call_once(filled, [] {
+        for (uint32_t k = 0; k < 256; k++) {
+            uint32_t c = k;
+            for (int b = 0; b < 8; b++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[k] = c;
+        }
+    });
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline uint32_t adler32(const unsigned char* data, size_t n) {
+    uint64_t a = 1, b = 0;
+    while (n > 0) {
+        size_t run = n < 5552 ? n : 5552;   // the longest run before b can overflow 32 bits
+        n -= run;
+        while (run--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return static_cast<uint32_t>((b << 16) | a);
+}
+
+inline uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t length2) {
+    // Adler-32 of two buffers back to back from the checksums of each (same algebra as zlib's adler32_combine).
+    const uint64_t base = 65521;
+    uint64_t rem = length2 % base;
+    uint64_t sum1 = adler1 & 0xffff;
+    uint64_t sum2 = (rem * sum1) % base;
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+    sum1 %= base;
+    sum2 %= base;
+    return static_cast<uint32_t>((sum2 << 16) | sum1);
+}
+
+inline int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = p > a ? p - a : a - p;
+    int pb = p > b ? p - b : b - p;
+    int pc = p > c ? p - c : c - p;
+    return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+inline void filter_rows(const uint8_t* rgb, int width, int first_row, int end_row, bool adaptive,
+                        std::vector<unsigned char>& out) {
+    // Filter byte plus filtered bytes for each row. Adaptive picks, per row, the filter with the smallest sum of
+    // absolute (signed) outputs, the usual heuristic; otherwise rows are stored unfiltered.
+    size_t stride = static_cast<size_t>(width) * 3;
+    out.resize((stride + 1) * (end_row - first_row));
+    std::vector<unsigned char> trial(stride);
+    for (int j = first_row; j < end_row; ++j) {
+        const uint8_t* row = rgb + j * stride;
+        const uint8_t* up = j > 0 ? row - stride : nullptr;
+        unsigned char* dst = out.data() + (j - first_row) * (stride + 1);
+        dst[0] = 0;
+        std::memcpy(dst + 1, row, stride);
+        if (!adaptive)
+            continue;
+
+        uint64_t best = ~uint64_t(0);
+        for (int filter = 0; filter < 5; ++filter) {
+            uint64_t cost = 0;
+            for (size_t x = 0; x < stride; ++x) {
+                int a = x >= 3 ? row[x - 3] : 0;
+                int b = up ? up[x] : 0;
+                int c = (up && x >= 3) ? up[x - 3] : 0;
+                int predicted = filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) / 2 : filter == 4 ? paeth(a, b, c) : 0;
+                auto v = static_cast<unsigned char>(row[x] - predicted);
+                trial[x] = v;
+                cost += v < 128 ? v : 256 - v;
+            }
+            if (cost < best) {
+                best = cost;
+                dst[0] = static_cast<unsigned char>(filter);
+                std::memcpy(dst + 1, trial.data(), stride);
+            }
+        }
+    }
+}
+
+inline void append_chunk(std::vector<unsigned char>& file, const char* type, const unsigned char* data, size_t n) {
+    unsigned char length[4] = { static_cast<unsigned char>(n >> 24), static_cast<unsigned char>(n >> 16),
+                                static_cast<unsigned char>(n >> 8), static_cast<unsigned char>(n) };
+    file.insert(file.end(), length, length + 4);
+    size_t start = file.size();
+    file.insert(file.end(), type, type + 4);
+    file.insert(file.end(), data, data + n);
+    uint32_t crc = crc32(0, file.data() + start, n + 4);
+    unsigned char tail[4] = { static_cast<unsigned char>(crc >> 24), static_cast<unsigned char>(crc >> 16),
+                              static_cast<unsigned char>(crc >> 8), static_cast<unsigned char>(crc) };
+    file.insert(file.end(), tail, tail + 4);
+}
+
+} // namespace png_detail
+
+
+class image_writer {
+public:
+    // The output stage: images handed to it are encoded and written on its own threads while the renderer goes
+    // on, and each PNG is split into row blocks that those threads compress in parallel.
+    // Files are written under a temporary name and renamed. When several images for one path are in flight
+    // (progressive snapshots), an older one never replaces a newer one that already reached the disk.
+
+    explicit image_writer(int thread_count) {
+        for (int k = 0; k < (thread_count > 0 ? thread_count : 1); ++k)
+            pool.emplace_back([this] { work(); });
+    }
+
+    image_writer(const image_writer&) = delete;
+    image_writer& operator=(const image_writer&) = delete;
+
+    ~image_writer() {
+        drain();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : pool)
+            t.join();
+    }
+
+    void write_png(const std::string& path, std::vector<uint8_t> rgb, int width, int height, png_level level,
+                   std::function<void(bool)> written = nullptr) {
+        // written(ok), when given, is called on a writer thread once the file is in place (or has failed).
+        auto job = std::make_shared<png_job>();
+        job->path = path;
+        job->written = std::move(written);
+        job->rgb = std::move(rgb);
+        job->width = width;
+        job->height = height;
+        job->level = level;
+
+        size_t row_bytes = static_cast<size_t>(width) * 3 + 1;
+        int rows = static_cast<int>(block_bytes / row_bytes);
+        job->rows_per_block = rows > 0 ? rows : 1;
+#ifndef RT_HAVE_ZLIB
+        if (level != png_uncompressed)
+            job->rows_per_block = height;   // stb's compressor makes a whole zlib stream; it can't be split
+#endif
+        int blocks = (height + job->rows_per_block - 1) / job->rows_per_block;
+        job->blocks.resize(blocks);
+        job->remaining = blocks;
+
+        std::lock_guard<std::mutex> guard(lock);
+        job->generation = ++generations;
+        pending++;
+        for (int b = 0; b < blocks; ++b)
+            tasks.push_back([this, job, b] { encode_block(*job, b); finish_block(job); });
+        wake.notify_all();
+    }
+
+    void drain() {
+        // Waits until every image handed over so far is on disk (or has failed).
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return pending == 0; });
+    }
+
+private:
+    static const size_t block_bytes = 256 * 1024;   // filtered bytes per block: big enough that merging is free
+
+    struct png_block {
+        std::vector<unsigned char> deflated;
+        uint32_t adler = 1;
+        size_t raw_bytes = 0;
+    };
+
+    struct png_job {
+        std::string path;
+        std::vector<uint8_t> rgb;
+        int width = 0, height = 0, rows_per_block = 1;
+        png_level level = png_default;
+        std::vector<png_block> blocks;
+        int remaining = 0;
+        uint64_t generation = 0;
+        std::function<void(bool)> written;
+    };
+
+    std::vector<std::thread> pool;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable wake, idle;
+    std::map<std::string, uint64_t> written;    // newest generation renamed into place per path
+    uint64_t generations = 0;
+    int pending = 0;
+    bool stopping = false;
+
+    void work() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    void encode_block(png_job& job, int b) {
+        int first = b * job.rows_per_block;
+        int end = std::min(first + job.rows_per_block, job.height);
+        bool last = end == job.height;
+        auto& block = job.blocks[b];
+
+        std::vector<unsigned char> raw;
+        png_detail::filter_rows(job.rgb.data(), job.width, first, end, job.level != png_uncompressed, raw);
+        block.adler = png_detail::adler32(raw.data(), raw.size());
+        block.raw_bytes = raw.size();
+
+        if (job.level == png_uncompressed) {
+            // Stored blocks of at most 65535 bytes: header byte (BFINAL on the very last), LEN, NLEN, data.
+            for (size_t at = 0; at < raw.size(); ) {
+                size_t n = std::min<size_t>(raw.size() - at, 65535);
+                bool final_block = last && at + n == raw.size();
+                unsigned char header[5] = { static_cast<unsigned char>(final_block ? 1 : 0),
+                                            static_cast<unsigned char>(n), static_cast<unsigned char>(n >> 8),
+                                            static_cast<unsigned char>(~n), static_cast<unsigned char>(~n >> 8) };
+                block.deflated.insert(block.deflated.end(), header, header + 5);
+                block.deflated.insert(block.deflated.end(), raw.begin() + at, raw.begin() + at + n);
+                at += n;
+            }
+            return;
+        }
+
+#ifdef RT_HAVE_ZLIB
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, job.level == png_fast ? 1 : 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        if (first > 0) {
+            // The previous block's last 32 KB, filtered exactly as that block filters them, as the dictionary:
+            // matches may reach back across the boundary just as in a single stream.
+            size_t row_bytes = static_cast<size_t>(job.width) * 3 + 1;
+            int back = static_cast<int>((32768 + row_bytes - 1) / row_bytes);
+            std::vector<unsigned char> previous;
+            png_detail::filter_rows(job.rgb.data(), job.width, std::max(first - back, 0), first, true, previous);
+            size_t n = std::min<size_t>(previous.size(), 32768);
+            deflateSetDictionary(&zs, previous.data() + previous.size() - n, static_cast<uInt>(n));
+        }
+        block.deflated.resize(deflateBound(&zs, raw.size()) + 16);
+        zs.next_in = raw.data();
+        zs.avail_in = static_cast<uInt>(raw.size());
+        zs.next_out = block.deflated.data();
+        zs.avail_out = static_cast<uInt>(block.deflated.size());
+        // Z_SYNC_FLUSH ends with an empty stored block, which leaves the stream byte aligned and not final.
+        deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        block.deflated.resize(zs.total_out);
+        deflateEnd(&zs);
+#else
+        // One block holding the whole image: stb's stream already has the zlib header and checksum.
+        int length = 0;
+        unsigned char* data = stbi_zlib_compress(raw.data(), static_cast<int>(raw.size()), &length,
+                                                 job.level == png_fast ? 1 : 8);
+        block.deflated.assign(data, data + length);
+        std::free(data);
+#endif
+    }
+
+    void finish_block(const std::shared_ptr<png_job>& job) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--job->remaining > 0)
+                return;
+        }
+        save(*job);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--pending == 0)
+            idle.notify_all();
+    }
+
+    void save(png_job& job) {
+        // Signature, IHDR, the merged zlib stream as one IDAT per block, IEND.
+        std::vector<unsigned char> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        unsigned char ihdr[13] = {
+            static_cast<unsigned char>(job.width >> 24), static_cast<unsigned char>(job.width >> 16),
+            static_cast<unsigned char>(job.width >> 8), static_cast<unsigned char>(job.width),
+            static_cast<unsigned char>(job.height >> 24), static_cast<unsigned char>(job.height >> 16),
+            static_cast<unsigned char>(job.height >> 8), static_cast<unsigned char>(job.height),
+            8, 2, 0, 0, 0   // 8-bit RGB, deflate, adaptive filtering, no interlace
+        };
+        png_detail::append_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+
+        bool whole_stream = false;
+#ifndef RT_HAVE_ZLIB
+        whole_stream = job.level != png_uncompressed;
+#endif
+        if (whole_stream) {
+            png_detail::append_chunk(file, "IDAT", job.blocks[0].deflated.data(), job.blocks[0].deflated.size());
+        } else {
+            unsigned char zlib_header[2] = { 0x78, static_cast<unsigned char>(job.level == png_default ? 0x9c : 0x01) };
+            png_detail::append_chunk(file, "IDAT", zlib_header, 2);
+            uint32_t adler = 1;
+            for (size_t b = 0; b < job.blocks.size(); ++b) {
+                const auto& block = job.blocks[b];
+                png_detail::append_chunk(file, "IDAT", block.deflated.data(), block.deflated.size());
+                adler = b == 0 ? block.adler : png_detail::adler32_combine(adler, block.adler, block.raw_bytes);
+            }
+            unsigned char trailer[4] = { static_cast<unsigned char>(adler >> 24), static_cast<unsigned char>(adler >> 16),
+                                         static_cast<unsigned char>(adler >> 8), static_cast<unsigned char>(adler) };
+            png_detail::append_chunk(file, "IDAT", trailer, 4);
+        }
+        png_detail::append_chunk(file, "IEND", nullptr, 0);
+
+        std::string tmp_path = job.path + ".tmp" + std::to_string(job.generation);
+        FILE* f = std::fopen(tmp_path.c_str(), "wb");
+        bool ok = f && std::fwrite(file.data(), 1, file.size(), f) == file.size();
+        ok = f && (std::fclose(f) == 0) && ok;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto& newest = written[job.path];
+            if (ok && newest > job.generation) {
+                std::remove(tmp_path.c_str());      // a later snapshot got there first
+            } else if (!ok || std::rename(tmp_path.c_str(), job.path.c_str()) != 0) {
+                std::clog << "Failed to write " << job.path << ".\n";
+                std::remove(tmp_path.c_str());
+                ok = false;
+            } else {
+                newest = job.generation;
+            }
+        }
+        if (job.written)
+            job.written(ok);
+    }
+};
+
+
+class png_stream {
+public:
+    // One PNG written a band of rows at a time, for images that never exist whole in memory (assembled from a
+    // tile_store). Single zlib stream on the calling thread, flushed to the file as IDAT chunks of about 256 KB;
+    // memory use is one band plus zlib's window. Without RT_HAVE_ZLIB every level is written as stored blocks.
+    // The file appears under its name only when close() succeeds.
+
+    png_stream() {}
+    png_stream(const png_stream&) = delete;
+    png_stream& operator=(const png_stream&) = delete;
+
+    ~png_stream() {
+        if (f) {
+            std::fclose(f);
+            std::remove(tmp_path.c_str());
+        }
+#ifdef RT_HAVE_ZLIB
+        if (deflating)
+            deflateEnd(&zs);
+#endif
+    }
+
+    bool open(const std::string& file_path, int w, int h, png_level png_compression) {
+        path = file_path;
+        tmp_path = path + ".tmp";
+        width = w;
+        height = h;
+        level = png_compression;
+        f = std::fopen(tmp_path.c_str(), "wb");
+        if (!f) {
+            std::clog << "Failed to write " << path << ".\n";
+            return false;
+        }
+
+        std::vector<unsigned char> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        unsigned char ihdr[13] = {
+            static_cast<unsigned char>(w >> 24), static_cast<unsigned char>(w >> 16),
+            static_cast<unsigned char>(w >> 8), static_cast<unsigned char>(w),
+            static_cast<unsigned char>(h >> 24), static_cast<unsigned char>(h >> 16),
+            static_cast<unsigned char>(h >> 8), static_cast<unsigned char>(h),
+            8, 2, 0, 0, 0
+        };
+        png_detail::append_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+        failed = std::fwrite(file.data(), 1, file.size(), f) != file.size();
+
+#ifdef RT_HAVE_ZLIB
+        if (level != png_uncompressed) {
+            std::memset(&zs, 0, sizeof(zs));
+            deflating = deflateInit(&zs, level == png_fast ? 1 : 6) == Z_OK;
+            failed = failed || !deflating;
+            return !failed;
+        }
+#endif
+        unsigned char zlib_header[2] = { 0x78, 0x01 };
+        pending.assign(zlib_header, zlib_header + 2);
+        return !failed;
+    }
+
+    bool write_rows(const uint8_t* rgb, int rows) {
+        // The next `rows` rows of 8-bit RGB, top to bottom. The last row of the previous call is kept for the
+        // Up/Average/Paeth filters.
+        size_t stride = static_cast<size_t>(width) * 3;
+        int first = previous.empty() ? 0 : 1;
+        previous.insert(previous.end(), rgb, rgb + stride * rows);
+        png_detail::filter_rows(previous.data(), width, first, first + rows, level != png_uncompressed, filtered);
+        previous.erase(previous.begin(), previous.end() - stride);
+        rows_written += rows;
+        add(filtered.data(), filtered.size(), false);
+        return !failed;
+    }
+
+    bool close() {
+        // Ends the zlib stream, writes IEND and renames the file into place.
+        if (rows_written != height) {
+            std::clog << "PNG " << path << " got " << rows_written << " of " << height << " rows.\n";
+            failed = true;
+        }
+        add(nullptr, 0, true);
+        std::vector<unsigned char> file;
+        png_detail::append_chunk(file, "IEND", nullptr, 0);
+        bool ok = !failed && std::fwrite(file.data(), 1, file.size(), f) == file.size();
+        ok = (std::fclose(f) == 0) && ok;
+        f = nullptr;
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::clog << "Failed to write " << path << ".\n";
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const size_t chunk_bytes = 256 * 1024;
+
+    FILE* f = nullptr;
+    std::string path, tmp_path;
+    int width = 0, height = 0, rows_written = 0;
+    png_level level = png_default;
+    std::vector<uint8_t> previous;          // the previous band's last row, then the band being filtered
+    std::vector<unsigned char> filtered;
+    std::vector<unsigned char> pending;     // zlib stream bytes not yet written as IDAT
+    uint32_t adler = 1;
+    bool failed = false;
+#ifdef RT_HAVE_ZLIB
+    z_stream zs;
+    bool deflating = false;
+#endif
+
+    void add(const unsigned char* data, size_t n, bool last) {
+#ifdef RT_HAVE_ZLIB
+        if (deflating) {
+            zs.next_in = const_cast<unsigned char*>(data);
+            zs.avail_in = static_cast<uInt>(n);
+            int status;
+            do {
+                size_t start = pending.size();
+                pending.resize(start + chunk_bytes);
+                zs.next_out = pending.data() + start;
+                zs.avail_out = static_cast<uInt>(chunk_bytes);
+                status = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+                pending.resize(pending.size() - zs.avail_out);
+                if (pending.size() >= chunk_bytes)
+                    flush();
+            } while (zs.avail_out == 0 || (last && status == Z_OK));
+            if (last) {
+                failed = failed || status != Z_STREAM_END;
+                deflateEnd(&zs);
+                deflating = false;
+                flush();
+            }
+            return;
+        }
+#endif
+        // Stored blocks (never final), then an empty final block and the Adler-32 to end the stream.
+        for (size_t at = 0; at < n; ) {
+            size_t run = std::min<size_t>(n - at, 65535);
+            unsigned char header[5] = { 0, static_cast<unsigned char>(run), static_cast<unsigned char>(run >> 8),
+                                        static_cast<unsigned char>(~run), static_cast<unsigned char>(~run >> 8) };
+            pending.insert(pending.end(), header, header + 5);
+            pending.insert(pending.end(), data + at, data + at + run);
+            at += run;
+            if (pending.size() >= chunk_bytes)
+                flush();
+        }
+        if (n > 0)
+            adler = png_detail::adler32_combine(adler, png_detail::adler32(data, n), n);
+        if (last) {
+            unsigned char tail[9] = { 1, 0, 0, 0xff, 0xff,
+                                      static_cast<unsigned char>(adler >> 24), static_cast<unsigned char>(adler >> 16),
+                                      static_cast<unsigned char>(adler >> 8), static_cast<unsigned char>(adler) };
+            pending.insert(pending.end(), tail, tail + 9);
+            flush();
+        }
+    }
+
+    void flush() {
+        if (pending.empty())
+            return;
+        std::vector<unsigned char> chunk;
+        png_detail::append_chunk(chunk, "IDAT", pending.data(), pending.size());
+        failed = failed || std::fwrite(chunk.data(), 1, chunk.size(), f) != chunk.size();
+        pending.clear();
+    }
+};
+
+#endif /* IMAGE_WRITER_H */
+
+// Note
+// 예전에는 렌더링이 다 끝난 뒤 render thread에서 stbi_write_png가 이미지 전체를 혼자 압축했음. (8K에서는 몇 초)
+// 여기서는 row block 단위로 filter + deflate를 병렬로 하고, pigz처럼 sync flush와 Adler-32 combine으로 하나의 zlib stream으로 합침.
+// The encode runs on its own threads, so a progressive snapshot is compressed while the next passes render.
+// png_stream은 전체 이미지가 메모리에 없는 out-of-core 렌더링용으로, band 단위로 filter + deflate 해서 바로 파일에 씀.
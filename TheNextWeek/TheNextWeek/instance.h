@@ -0,0 +1,157 @@
+//
+//  instance.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+class affine_transform {
+public:
+    // 3x4 row-major matrix: the left 3x3 is the linear part, the last column the translation.
+    double m[3][4];
+
+    affine_transform() : m{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}} {}
+
+    static affine_transform translate(const vec3& offset) {
+        affine_transform t;
+        t.m[0][3] = offset.x();
+        t.m[1][3] = offset.y();
+        t.m[2][3] = offset.z();
+        return t;
+    }
+
+    static affine_transform scale(const vec3& s) {
+        affine_transform t;
+        t.m[0][0] = s.x();
+        t.m[1][1] = s.y();
+        t.m[2][2] = s.z();
+        return t;
+    }
+
+    static affine_transform rotate(const vec3& axis, double degrees) {
+        // Rodrigues' rotation formula around a (normalized) axis.
+        auto a = unit_vector(axis);
+        auto theta = degrees_to_radians(degrees);
+        auto c = cos(theta), s = sin(theta), k = 1 - c;
+
+        affine_transform t;
+        t.m[0][0] = c + a.x()*a.x()*k;          t.m[0][1] = a.x()*a.y()*k - a.z()*s;   t.m[0][2] = a.x()*a.z()*k + a.y()*s;
+        t.m[1][0] = a.y()*a.x()*k + a.z()*s;    t.m[1][1] = c + a.y()*a.y()*k;         t.m[1][2] = a.y()*a.z()*k - a.x()*s;
+        t.m[2][0] = a.z()*a.x()*k - a.y()*s;    t.m[2][1] = a.z()*a.y()*k + a.x()*s;   t.m[2][2] = c + a.z()*a.z()*k;
+        return t;
+    }
+
+    affine_transform operator*(const affine_transform& b) const {
+        // (this * b) applies b first.
+        affine_transform t;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                t.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j];
+                if (j == 3)
+                    t.m[i][j] += m[i][3];
+            }
+        }
+        return t;
+    }
+
+    point3 apply_point(const point3& p) const {
+        return point3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                      m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                      m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                    m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                    m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+
+    vec3 apply_transposed(const vec3& v) const {
+        // Linear part transposed; with the inverse transform this is how normals are carried over.
+        return vec3(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                    m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                    m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+    }
+
+    affine_transform inverse() const {
+        // Invert the 3x3 by cofactors, then the translation is -inverse(L) * t.
+        affine_transform inv;
+        double det = m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                   - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                   + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        double inv_det = 1 / det;
+
+        inv.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        inv.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+        inv.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        inv.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+        inv.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        inv.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+        inv.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        inv.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+        inv.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+        auto t = inv.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        inv.m[0][3] = -t.x();
+        inv.m[1][3] = -t.y();
+        inv.m[2][3] = -t.z();
+        return inv;
+    }
+};
+
+class instance : public hittable {
+public:
+    // Places a shared object (usually a whole bvh_node) in the world through an affine transform.
+    // Any number of instances can point at the same object; each one only costs its two matrices and a box.
+    // A bvh_node over instances is the top level of a two-level acceleration structure.
+    instance(shared_ptr<hittable> object, const affine_transform& object_to_world)
+        : child(object), to_world(object_to_world), to_object(object_to_world.inverse())
+    {
+        // The world box is the box around the eight transformed corners of the child's box.
+        auto box = child->bounding_box();
+        for (int i = 0; i < 8; i++) {
+            auto corner = point3((i & 1) ? box.x.max : box.x.min,
+                                 (i & 2) ? box.y.max : box.y.min,
+                                 (i & 4) ? box.z.max : box.z.min);
+            auto p = to_world.apply_point(corner);
+            bbox = aabb(bbox, aabb(p, p));
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Move the ray into object space. The direction is transformed but not renormalized,
+        // so a hit at parameter t is the same point in both spaces and ray_t carries over unchanged.
+        ray object_ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+
+        if (!child->hit(object_ray, ray_t, rec))
+            return false;
+
+        // Back to world space. Normals go through the inverse transpose; the sign of dot(direction, normal)
+        // is preserved by that, so front_face from the object-space test stays valid.
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    shared_ptr<hittable> child;
+    affine_transform to_world;
+    affine_transform to_object;
+    aabb bbox;
+};
+
+#endif /* INSTANCE_H */
+
+// Note
+// 같은 sphere cluster를 수천 번 반복하는 씬에서 hittable_list/bvh_node로 복사하면 copy마다 별도의 heap object가 생김.
+// instance는 ray를 object space로 옮겨 공유된 child BVH에 대해 hit을 계산하고, 결과를 다시 world space로 돌려놓음.
+// Memory then grows with the unique geometry, and each extra copy is one instance in the top-level BVH.
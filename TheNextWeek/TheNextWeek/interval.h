@@ -16,6 +16,10 @@ public:
     interval(double _min, double _max) : min(_min), max(_max) {}
     interval(const interval& a, const interval& b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
 
+    double size() const {
+        return max - min;
+    }
+
     bool contains(double x) const {
         return min <= x && x <= max;
     }
@@ -0,0 +1,105 @@
+//
+//  lazy_bvh.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef LAZY_BVH_H
+#define LAZY_BVH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+class lazy_bvh_node : public hittable {
+public:
+    lazy_bvh_node(const hittable_list& list)
+        : lazy_bvh_node(std::make_shared<std::vector<shared_ptr<hittable>>>(list.objects), 0, list.objects.size()) {}
+
+    lazy_bvh_node(shared_ptr<std::vector<shared_ptr<hittable>>> shared_objects, size_t _start, size_t _end)
+        : objects(shared_objects), start(_start), end(_end)
+    {
+        // Only the bounds of the range are computed up front (one linear pass, no sorting),
+        // so the whole tree costs O(n) to create and the real split is deferred to the first ray that enters.
+        for (size_t i = start; i < end; i++)
+            bbox = aabb(bbox, (*objects)[i]->bounding_box());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        // The first ray to reach this node builds its children; concurrent rays wait on the same flag.
+        // std::call_once also publishes left/right to every later caller, so no extra fence is needed.
+        std::call_once(built, &lazy_bvh_node::build, this);
+
+        bool hit_left = left->hit(r, ray_t, rec);
+        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    shared_ptr<std::vector<shared_ptr<hittable>>> objects;  // shared by the whole tree, each node owns [start,end)
+    size_t start, end;
+    aabb bbox;
+
+    mutable std::once_flag built;
+    mutable shared_ptr<hittable> left;
+    mutable shared_ptr<hittable> right;
+
+    void build() const {
+        size_t object_span = end - start;
+        auto& objs = *objects;
+
+        if (object_span == 1) {
+            left = right = objs[start];
+            return;
+        }
+        if (object_span == 2) {
+            left = objs[start];
+            right = objs[start+1];
+            return;
+        }
+
+        // Split along the longest axis of the centroid bounds at the median.
+        // nth_element is O(n) per level instead of a full sort, and it only reorders this node's own range,
+        // so sibling subtrees can be built concurrently without touching each other's primitives.
+        aabb centroid_box;
+        for (size_t i = start; i < end; i++) {
+            auto c = centroid(objs[i]->bounding_box());
+            centroid_box = aabb(centroid_box, aabb(c, c));
+        }
+        int axis = 0;
+        if (centroid_box.y.size() > centroid_box.axis(axis).size()) axis = 1;
+        if (centroid_box.z.size() > centroid_box.axis(axis).size()) axis = 2;
+
+        auto mid = start + object_span/2;
+        std::nth_element(objs.begin() + start, objs.begin() + mid, objs.begin() + end,
+            [axis](const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
+                return centroid(a->bounding_box())[axis] < centroid(b->bounding_box())[axis];
+            });
+
+        left = make_shared<lazy_bvh_node>(objects, start, mid);
+        right = make_shared<lazy_bvh_node>(objects, mid, end);
+    }
+
+    static point3 centroid(const aabb& box) {
+        return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    }
+};
+
+#endif /* LAZY_BVH_H */
+
+// Note
+// bvh_node와 같은 hit 인터페이스를 가지지만, 트리는 ray가 처음 노드에 들어올 때 한 단계씩만 만들어짐.
+// 카메라가 씬의 일부만 보는 경우 보이지 않는 subtree는 끝까지 만들어지지 않기 때문에 time-to-first-pixel이 크게 줄어듦.
+// Building the full tree eagerly is still O(n log n); here the root costs one bounds pass and every later level is paid for only where rays go.
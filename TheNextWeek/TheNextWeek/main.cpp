@@ -7,19 +7,34 @@
 
 #include "rtweekend.h"
 
+#include "animation.h"
 #include "bvh.h"
+#include "bvh_cache.h"
 #include "camera.h"
 #include "color.h"
+#include "compressed_bvh.h"
 #include "hittable_list.h"
+#include "instance.h"
+#include "lazy_bvh.h"
 #include "material.h"
+#include "obj_loader.h"
+#include "paged_bvh.h"
+#include "render_server.h"
+#include "scene_file.h"
+#include "scene_parser.h"
 #include "sphere.h"
+#include "triangle_mesh.h"
 
-int main(int argc, const char * argv[]) {
-    
-    hittable_list world;
-    
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+size_t random_spheres(scene_data& scene) {
+    // Returns the index of the large glass sphere in the middle, which --obj replaces.
+    auto ground_material = scene.add_material(scene_material_lambertian, color(0.5, 0.5, 0.5));
+    scene.add_sphere(point3(0,-1000,0), 1000, ground_material);
     
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -27,41 +42,40 @@ int main(int argc, const char * argv[]) {
             point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
 
             if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
+                uint32_t sphere_material;
 
                 if (choose_mat < 0.8) {
                     // diffuse; spheres move from its center C at time t=0 to C+(0,r/2,0) at time t=1.
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
+                    sphere_material = scene.add_material(scene_material_lambertian, albedo);
                     auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(make_shared<sphere>(center, center2, 0.2, sphere_material));
+                    scene.add_sphere(center, center2, 0.2, sphere_material);
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.add_material(scene_material_metal, albedo, fuzz);
+                    scene.add_sphere(center, 0.2, sphere_material);
                 } else {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = scene.add_material(scene_material_dielectric, color(1, 1, 1), 1.5);
+                    scene.add_sphere(center, 0.2, sphere_material);
                 }
             }
         }
     }
     
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = scene.add_material(scene_material_dielectric, color(1, 1, 1), 1.5);
+    auto center_sphere = scene.spheres.size();
+    scene.add_sphere(point3(0, 1, 0), 1.0, material1);
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material2 = scene.add_material(scene_material_lambertian, color(0.4, 0.2, 0.1));
+    scene.add_sphere(point3(-4, 1, 0), 1.0, material2);
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material3 = scene.add_material(scene_material_metal, color(0.7, 0.6, 0.5), 0.0);
+    scene.add_sphere(point3(4, 1, 0), 1.0, material3);
     
-    world = hittable_list(make_shared<bvh_node>(world));
-    
-    camera cam;
+    auto& cam = scene.camera;
     
     cam.aspect_ratio = 16.0 / 9.0;
     cam.image_width = 400;
@@ -69,13 +83,486 @@ int main(int argc, const char * argv[]) {
     cam.max_depth = 50;
 
     cam.vfov = 20;
-    cam.lookfrom = point3(13,2,3);
-    cam.lookat = point3(0,0,0);
-    cam.vup = vec3(0,1,0);
+    cam.lookfrom[0] = 13;  cam.lookfrom[1] = 2;  cam.lookfrom[2] = 3;
+    cam.lookat[0] = 0;     cam.lookat[1] = 0;    cam.lookat[2] = 0;
+    cam.vup[0] = 0;        cam.vup[1] = 1;       cam.vup[2] = 0;
 
     cam.defocus_angle = 0.6;
     cam.focus_dist = 10.0;
+    return center_sphere;
+}
+
+hittable_list instanced_clusters(const scene_data& scene, int count, scene_camera_record& settings) {
+    // Repeats the random sphere cluster `count` times on a grid, each copy turned by a random angle.
+    // Every copy is an instance of one shared bvh_node, so memory stays at one cluster plus one instance per copy.
+    auto spheres = scene.build_world();
+    auto ground = spheres.objects[0];
+    spheres.objects.erase(spheres.objects.begin());
+    auto cluster = make_shared<bvh_node>(spheres);
+
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    const double spacing = 24;
+    hittable_list instances;
+    for (int k = 0; k < count; k++) {
+        auto offset = vec3((k % side - 0.5 * (side - 1)) * spacing, 0, (k / side - 0.5 * (side - 1)) * spacing);
+        auto transform = affine_transform::translate(offset) * affine_transform::rotate(vec3(0,1,0), random_double(0, 360));
+        instances.add(make_shared<instance>(cluster, transform));
+    }
+    
+    hittable_list world;
+    world.add(ground);
+    world.add(make_shared<bvh_node>(instances));
+    
+    // Pull the camera back so the whole grid is in view.
+    for (int a = 0; a < 3; a++)
+        settings.lookfrom[a] *= side;
+    settings.focus_dist *= side;
+    settings.defocus_angle = 0;
+    return world;
+}
+
+shared_ptr<hittable> fitted_mesh(const std::string& path, const point3& center, double size) {
+    // Loads an OBJ mesh with its own BVH and scales it (through an instance) to fit a size^3 box at center.
+    auto mesh = make_shared<mesh_data>();
+    mesh->mat = make_shared<metal>(color(0.8, 0.85, 0.88), 0.05);
+    if (!load_obj(path, *mesh))
+        return nullptr;
+    if (mesh->triangle_count() == 0) {
+        std::clog << "OBJ file " << path << " has no faces.\n";
+        return nullptr;
+    }
+    
+    auto tree = make_shared<triangle_mesh>(mesh_triangles(mesh));
+    if (!tree->built())
+        return nullptr;
+    std::clog << "Mesh: " << mesh->triangle_count() << " triangles, "
+              << static_cast<double>(mesh->memory_bytes() + tree->memory_bytes()) / mesh->triangle_count()
+              << " bytes per triangle including its BVH.\n";
+    
+    auto box = tree->bounding_box();
+    auto extent = std::fmax(box.x.size(), std::fmax(box.y.size(), box.z.size()));
+    auto mid = point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    auto scale = extent > 0 ? size / extent : 1.0;
+    auto transform = affine_transform::translate(center) * affine_transform::scale(vec3(scale, scale, scale))
+                   * affine_transform::translate(-mid);
+    return make_shared<instance>(tree, transform);
+}
+
+void configure_camera(camera& cam, const scene_camera_record& settings) {
+    cam.aspect_ratio = settings.aspect_ratio;
+    cam.image_width = settings.image_width;
+    cam.samples_per_pixel = settings.samples_per_pixel;
+    cam.max_depth = settings.max_depth;
+
+    cam.vfov = settings.vfov;
+    cam.lookfrom = point3(settings.lookfrom[0], settings.lookfrom[1], settings.lookfrom[2]);
+    cam.lookat = point3(settings.lookat[0], settings.lookat[1], settings.lookat[2]);
+    cam.vup = vec3(settings.vup[0], settings.vup[1], settings.vup[2]);
+
+    cam.defocus_angle = settings.defocus_angle;
+    cam.focus_dist = settings.focus_dist;
+}
+
+void print_usage(const char* argument) {
+    // The options are described next to their variables at the top of main.
+    std::clog << "Unknown argument, or one missing its value: " << argument << "\n"
+                 "Usage: result [options]\n"
+                 "  scene:    --scene <file> --obj <file> --instances <n> --spp <n> --jitter random|stratified|none\n"
+                 "  BVH:      --lazy-bvh | --bvh-cache <dir> | --compressed-bvh | --arena | --huge-pages\n"
+                 "            | --typed-kernel | --packed-spheres\n"
+                 "  files:    --write-scene <file> --write-treelets <file> --page-kb <n> --cache-mb <n>\n"
+                 "  output:   --output <file.png> --png uncompressed|fast|default --encode-threads <n> --hdr <file.pfm>\n"
+                 "            --exposure <stops> --tonemap clamp|reinhard --stream ppm|pfm --tiles-out <file.rttiles>\n"
+                 "  progress: --checkpoint <file> --checkpoint-seconds <s> --resume --progressive --snapshot-passes <n>\n"
+                 "            --snapshot-seconds <s> --time-budget <s> --noise-target <x> --threads <n> --tile <n>\n"
+                 "  farm:     --coordinate <address> --worker <address> --unit-timeout <s>\n"
+                 "  views:    --views <n> --baseline <d> --view-share <pixels>\n"
+                 "  sequence: --animation <file> --frames <n> --fps <rate> --shutter <fraction>\n"
+                 "            --temporal <fresh spp> --temporal-tolerance <x> --temporal-check\n"
+                 "  server:   --serve <address> --batch <jobs.txt> --scene-cache <n> --output-dir <dir>\n"
+                 "            --scene-dir <dir> --submit <address> \"<request>\"\n";
+}
+
+int main(int argc, const char * argv[]) {
+    bool lazy_bvh = false;          // --lazy-bvh: build BVH subtrees on first ray entry instead of up front
+    std::string scene_path;         // --scene <file>: render a .rtscene file straight from its mapping, or a text scene
+    std::string write_scene_path;   // --write-scene <file>: save the built-in scene (with its BVH) as .rtscene
+    std::string treelet_path;       // --write-treelets <file>: save the built-in scene as paged BVH treelets (.rttree)
+    int page_kb = 64;               // --page-kb <n>: treelet page size for --write-treelets
+    int cache_mb = 256;             // --cache-mb <n>: treelet pages kept mapped while rendering a .rttree scene
+    std::string bvh_cache_dir;      // --bvh-cache <dir>: reuse the bvh_node tree from an earlier run of the same scene
+    bool compressed = false;        // --compressed-bvh: 20-byte nodes with 8-bit quantized child bounds
+    std::string obj_path;           // --obj <file>: put an OBJ mesh where the center glass sphere was
+    int instances = 0;              // --instances <n>: render n instanced copies of the sphere cluster
+    bool typed = false;             // --typed-kernel: render a concrete compressed_bvh<object_set<sphere>>, no virtual hits
+    bool packed = false;            // --packed-spheres: sphere_set (16-byte spheres) under a compressed BVH
+    jitter_mode jitter = jitter_random;  // --jitter random|stratified|none: sample placement inside a pixel
+    std::string hdr_path;           // --hdr <file.pfm>: also save the linear radiance as a float image
+    resolve_settings tonemap;       // --exposure <stops>, --tonemap clamp|reinhard: how the PNG is resolved
+    std::string checkpoint_path;    // --checkpoint <file>: save the accumulation state while rendering (.rtckpt)
+    double checkpoint_seconds = 60; // --checkpoint-seconds <s>: time between checkpoints
+    bool resume = false;            // --resume: continue from --checkpoint; with a higher --spp it tops up a finished render
+    int spp = 0;                    // --spp <n>: samples per pixel instead of the scene's own
+    camera cam;                     // --progressive, --snapshot-passes <n>, --snapshot-seconds <s>,
+                                    // --time-budget <s>, --noise-target <x>, --threads <n>, --tile <n>,
+                                    // --stream ppm|pfm, --output <file.png>, --png uncompressed|fast|default,
+                                    // --encode-threads <n>, --tiles-out <file.rttiles>, --coordinate <address>,
+                                    // --worker <address>, --unit-timeout <s>, --views <n>, --baseline <d>,
+                                    // --view-share <pixels>, --temporal <fresh spp>, --temporal-tolerance <x>,
+                                    // --temporal-check: see camera
+    bool use_arena = false;         // --arena: place spheres, materials and bvh_nodes in a scene_arena
+    bool huge_pages = false;        // --huge-pages: back the arena with transparent huge pages
+    std::string serve_address;      // --serve <address>: run as a render server (see render_server.h)
+    int scene_cache_size = 4;       // --scene-cache <n>: built scenes the server keeps loaded
+    std::string output_dir = ".";   // --output-dir <dir>: where the server writes the images requests name
+    std::string scene_dir = ".";    // --scene-dir <dir>: where the server reads the scene files requests name
+    std::string submit_address;     // --submit <address> "<request>": send one request to a render server
+    std::string submit_request;
+    std::string batch_path;         // --batch <jobs.txt>: render every request line of a job file in this process
+    std::string animation_path;     // --animation <file>: render the built-in scene as an animation (see animation.h)
+    int frames = 0;                 // --frames <n>, --fps <rate>, --shutter <fraction>: override the animation file's;
+    double fps = 0;                 // --frames alone bounces the moving spheres. Frames are written to --output
+    double shutter = -1;            // with the frame number in place of %04d (or before the extension)
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--lazy-bvh") == 0)
+            lazy_bvh = true;
+        else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+            scene_path = argv[++i];
+        else if (std::strcmp(argv[i], "--write-scene") == 0 && i + 1 < argc)
+            write_scene_path = argv[++i];
+        else if (std::strcmp(argv[i], "--write-treelets") == 0 && i + 1 < argc)
+            treelet_path = argv[++i];
+        else if (std::strcmp(argv[i], "--page-kb") == 0 && i + 1 < argc)
+            page_kb = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc)
+            cache_mb = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--bvh-cache") == 0 && i + 1 < argc)
+            bvh_cache_dir = argv[++i];
+        else if (std::strcmp(argv[i], "--compressed-bvh") == 0)
+            compressed = true;
+        else if (std::strcmp(argv[i], "--obj") == 0 && i + 1 < argc)
+            obj_path = argv[++i];
+        else if (std::strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+            instances = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--typed-kernel") == 0)
+            typed = true;
+        else if (std::strcmp(argv[i], "--packed-spheres") == 0)
+            packed = true;
+        else if (std::strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            ++i;
+            jitter = (std::strcmp(argv[i], "stratified") == 0) ? jitter_stratified
+                   : (std::strcmp(argv[i], "none") == 0) ? jitter_none : jitter_random;
+        }
+        else if (std::strcmp(argv[i], "--hdr") == 0 && i + 1 < argc)
+            hdr_path = argv[++i];
+        else if (std::strcmp(argv[i], "--exposure") == 0 && i + 1 < argc)
+            tonemap.exposure = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--tonemap") == 0 && i + 1 < argc)
+            tonemap.curve = (std::strcmp(argv[++i], "reinhard") == 0) ? tone_reinhard : tone_clamp;
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+            checkpoint_path = argv[++i];
+        else if (std::strcmp(argv[i], "--checkpoint-seconds") == 0 && i + 1 < argc)
+            checkpoint_seconds = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if (std::strcmp(argv[i], "--spp") == 0 && i + 1 < argc)
+            spp = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--progressive") == 0)
+            cam.progressive = true;
+        else if (std::strcmp(argv[i], "--snapshot-passes") == 0 && i + 1 < argc)
+            cam.snapshot_passes = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--snapshot-seconds") == 0 && i + 1 < argc)
+            cam.snapshot_seconds = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--time-budget") == 0 && i + 1 < argc)
+            cam.time_budget = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--noise-target") == 0 && i + 1 < argc)
+            cam.noise_target = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            cam.threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+            cam.tile_size = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            ++i;
+            cam.stream = (std::strcmp(argv[i], "pfm") == 0) ? stream_pfm
+                       : (std::strcmp(argv[i], "ppm") == 0) ? stream_ppm : stream_none;
+        }
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            cam.output_path = argv[++i];
+        else if (std::strcmp(argv[i], "--png") == 0 && i + 1 < argc) {
+            ++i;
+            cam.png_compression = (std::strcmp(argv[i], "uncompressed") == 0) ? png_uncompressed
+                                : (std::strcmp(argv[i], "fast") == 0) ? png_fast : png_default;
+        }
+        else if (std::strcmp(argv[i], "--encode-threads") == 0 && i + 1 < argc)
+            cam.encode_threads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--tiles-out") == 0 && i + 1 < argc)
+            cam.tile_path = argv[++i];
+        else if (std::strcmp(argv[i], "--coordinate") == 0 && i + 1 < argc)
+            cam.farm_listen = argv[++i];
+        else if (std::strcmp(argv[i], "--worker") == 0 && i + 1 < argc)
+            cam.farm_worker = argv[++i];
+        else if (std::strcmp(argv[i], "--unit-timeout") == 0 && i + 1 < argc)
+            cam.unit_timeout = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--views") == 0 && i + 1 < argc)
+            cam.views = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            cam.view_baseline = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--view-share") == 0 && i + 1 < argc)
+            cam.view_share = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--temporal") == 0 && i + 1 < argc) {
+            cam.temporal = true;
+            cam.temporal_samples = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--temporal-tolerance") == 0 && i + 1 < argc)
+            cam.temporal_tolerance = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--temporal-check") == 0)
+            cam.temporal_check = true;
+        else if (std::strcmp(argv[i], "--arena") == 0)
+            use_arena = true;
+        else if (std::strcmp(argv[i], "--huge-pages") == 0)
+            use_arena = huge_pages = true;
+        else if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            serve_address = argv[++i];
+        else if (std::strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc)
+            output_dir = argv[++i];
+        else if (std::strcmp(argv[i], "--scene-dir") == 0 && i + 1 < argc)
+            scene_dir = argv[++i];
+        else if (std::strcmp(argv[i], "--scene-cache") == 0 && i + 1 < argc)
+            scene_cache_size = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_path = argv[++i];
+        else if (std::strcmp(argv[i], "--animation") == 0 && i + 1 < argc)
+            animation_path = argv[++i];
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            fps = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--shutter") == 0 && i + 1 < argc)
+            shutter = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--submit") == 0 && i + 2 < argc) {
+            submit_address = argv[++i];
+            submit_request = argv[++i];
+        }
+        else {
+            print_usage(argv[i]);
+            return 1;
+        }
+    }
+    
+    // Each of these builds the built-in scene its own way; main would quietly use the first one it checks.
+    int structures = int(compressed) + int(use_arena) + int(lazy_bvh) + int(!bvh_cache_dir.empty())
+                   + int(packed) + int(typed) + int(instances > 0);
+    if (structures > 1) {
+        std::clog << "--compressed-bvh, --arena (or --huge-pages), --lazy-bvh, --bvh-cache, --packed-spheres, "
+                     "--typed-kernel and --instances each choose how the scene is built; use at most one.\n";
+        return 1;
+    }
+    
+    cam.jitter = jitter;
+    cam.hdr_path = hdr_path;
+    cam.tonemap = tonemap;
+    cam.checkpoint_path = checkpoint_path;
+    cam.checkpoint_seconds = checkpoint_seconds;
+    cam.resume = resume;
+    if (!cam.modes_compatible())
+        return 1;
+    
+    auto configure = [&](const scene_camera_record& settings) {
+        configure_camera(cam, settings);
+        if (spp > 0)
+            cam.samples_per_pixel = spp;
+    };
+    
+    auto ends_with = [](const std::string& s, const char* suffix) {
+        auto n = std::strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    };
+    
+    if (!submit_address.empty()) {
+        std::string reply;
+        bool ok = submit_render(submit_address, submit_request, reply);
+        std::cout << reply << '\n';
+        return ok ? 0 : 1;
+    }
+    
+    if (!serve_address.empty() || !batch_path.empty()) {
+        // The server builds scenes when a request first names them: "builtin" is the random sphere scene with a
+        // bvh_node, anything else a scene file. This command line's camera options are the defaults for every job.
+        auto load = [&](const std::string& reference) -> shared_ptr<server_scene> {
+            auto loaded = make_shared<server_scene>();
+            loaded->view = cam;
+            if (reference == "builtin") {
+                // Each request runs on a new thread, whose random numbers start from the same state: the same scene every time.
+                scene_data scene;
+                random_spheres(scene);
+                configure_camera(loaded->view, scene.camera);
+                loaded->view.motion_blur = scene.has_motion();
+                loaded->world = make_shared<bvh_node>(scene.build_world());
+            } else if (ends_with(reference, ".rtscene")) {
+                auto world = make_shared<flat_scene>();
+                if (!world->open(reference))
+                    return nullptr;
+                configure_camera(loaded->view, world->camera_settings());
+                loaded->world = world;
+            } else {
+                scene_parser parser;
+                if (!parser.load(reference))
+                    return nullptr;
+                configure_camera(loaded->view, parser.camera_settings());
+                loaded->world = parser.world();
+            }
+            if (spp > 0)
+                loaded->view.samples_per_pixel = spp;
+            return loaded;
+        };
+        int threads = cam.threads > 0 ? cam.threads : static_cast<int>(std::thread::hardware_concurrency());
+        render_server server(threads, static_cast<size_t>(scene_cache_size), load);
+        if (!batch_path.empty())
+            return server.run_batch(batch_path, std::cout) ? 0 : 1;
+        return server.serve(serve_address, output_dir, scene_dir) ? 0 : 1;
+    }
+    
+    if (ends_with(scene_path, ".rttree")) {
+        // render_batched() traces a single view and keeps no history.
+        if (cam.views > 1 || cam.temporal) {
+            std::clog << "--views and --temporal can't render a .rttree scene, which is traced in batches.\n";
+            return 1;
+        }
+        paged_bvh world;
+        if (!world.open(scene_path, size_t(cache_mb > 0 ? cache_mb : 1) << 20))
+            return 1;
+        
+        configure(world.camera_settings());
+        cam.render_batched(world);
+        std::clog << "Treelets: " << world.treelet_count() << " in file, " << world.cache_pages() << " cache pages, "
+                  << world.page_loads() << " loads, " << world.page_evictions() << " evictions.\n";
+        return 0;
+    }
+    
+    if (!scene_path.empty() && !ends_with(scene_path, ".rtscene")) {
+        scene_parser parser;
+        if (!parser.load(scene_path))
+            return 1;
+        
+        configure(parser.camera_settings());
+        cam.render(*parser.world());
+        return 0;
+    }
+    
+    if (!scene_path.empty()) {
+        flat_scene world;
+        if (!world.open(scene_path))
+            return 1;
+        
+        configure(world.camera_settings());
+        cam.render(world);
+        return 0;
+    }
+    
+    scene_data scene;
+    auto center_sphere = random_spheres(scene);
+    cam.motion_blur = scene.has_motion();
+    
+    if (!animation_path.empty() || frames > 0) {
+        animation sequence;
+        if (!animation_path.empty() && !sequence.load(animation_path))
+            return 1;
+        if (frames > 0)
+            sequence.frames = frames;
+        if (fps > 0)
+            sequence.fps = fps;
+        if (shutter >= 0)
+            sequence.shutter = std::min(shutter, 1.0);
+        if (animation_path.empty())
+            sequence.bounce(scene);
+        configure(scene.camera);
+        return render_sequence(cam, scene, sequence) ? 0 : 1;
+    }
+    
+    if (!write_scene_path.empty() || !treelet_path.empty()) {
+        // build_bvh puts the spheres in leaf order; the copy keeps the scene rendered below (and center_sphere) as it was.
+        scene_data written = scene;
+        written.build_bvh();
+        if (!write_scene_path.empty() && !written.write(write_scene_path))
+            return 1;
+        if (!treelet_path.empty() && !write_paged_bvh(written, treelet_path, static_cast<uint32_t>(page_kb) * 1024))
+            return 1;
+    }
+    
+    if (instances > 0) {
+        auto world = instanced_clusters(scene, instances, scene.camera);
+        configure(scene.camera);
+        cam.render(world);
+        return 0;
+    }
+    
+    if (packed) {
+        auto spheres = scene.build_sphere_set();
+        if (!spheres.valid())
+            return 1;
+        auto tree = make_shared<compressed_bvh<sphere_set>>(spheres);
+        if (!tree->built())
+            return 1;
+        std::clog << "Packed spheres: " << static_cast<double>(spheres.memory_bytes()) / spheres.size() << " bytes per sphere, "
+                  << static_cast<double>(tree->memory_bytes()) / spheres.size() << " BVH bytes per sphere.\n";
+        
+        configure(scene.camera);
+        cam.render(*tree);
+        return 0;
+    }
+    
+    if (typed) {
+        // The world's static type is the concrete accelerator, so camera::render is instantiated for it.
+        compressed_bvh<object_set<sphere>> tree(scene.build_spheres());
+        if (!tree.built())
+            return 1;
+        configure(scene.camera);
+        cam.render(tree);
+        return 0;
+    }
+    
+    shared_ptr<hittable> mesh;
+    if (!obj_path.empty()) {
+        mesh = fitted_mesh(obj_path, point3(0, 1, 0), 2.0);
+        if (!mesh)
+            return 1;
+        scene.spheres.erase(scene.spheres.begin() + center_sphere);
+    }
+    
+    scene_arena objects(huge_pages);
+    hittable_list world = scene.build_world(use_arena ? &objects : nullptr);
+    auto primitive_count = world.objects.size();
+    
+    if (compressed && primitive_count > compressed_bvh<hittable_set>::max_primitives) {
+        std::clog << "Too many primitives for --compressed-bvh, using bvh_node.\n";
+        compressed = false;
+    }
+    if (compressed) {
+        auto tree = make_shared<compressed_bvh<hittable_set>>(hittable_set(world));
+        if (!tree->built())
+            return 1;
+        std::clog << "Compressed BVH: " << tree->node_count() << " nodes, "
+                  << static_cast<double>(tree->memory_bytes()) / primitive_count << " bytes per primitive.\n";
+        world = hittable_list(tree);
+    } else if (use_arena)
+        world = hittable_list(objects.make_node<bvh_node>(world, objects.nodes));
+    else if (lazy_bvh)
+        world = hittable_list(make_shared<lazy_bvh_node>(world));
+    else if (!bvh_cache_dir.empty())
+        world = hittable_list(bvh_cache(bvh_cache_dir).load_or_build(world));
+    else
+        world = hittable_list(make_shared<bvh_node>(world));
+    
+    if (mesh)
+        world.add(mesh);
+    
+    if (use_arena) {
+        std::clog << "Scene arena: " << static_cast<double>(objects.bytes_used()) / primitive_count << " bytes per primitive ("
+                  << objects.primitives.bytes_used() << " primitives, " << objects.materials.bytes_used() << " materials, "
+                  << objects.nodes.bytes_used() << " nodes).\n";
+    }
     
+    configure(scene.camera);
     cam.render(world);
     
     return 0;
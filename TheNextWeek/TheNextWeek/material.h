@@ -12,16 +12,25 @@
 
 struct hit_record;
 
+// Which of the materials in this file an object is, so the render kernel can dispatch without the vtable.
+enum class material_kind { other, lambertian, metal, dielectric };
+
 class material {
 public:
+    const material_kind kind;
+    
+    material() : kind(material_kind::other) {}
     virtual ~material() = default;
     
     virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+    
+protected:
+    material(material_kind k) : kind(k) {}
 };
 
-class lambertian : public material {
+class lambertian final : public material {
 public:
-    lambertian(const color& a) : albedo(a) {}
+    lambertian(const color& a) : material(material_kind::lambertian), albedo(a) {}
     
     // True Lambertian Reflection:
     // Lambert's Cosine Law는 이상적인 난반사 표면(lambertian surface)에서 관찰되는 빛의 강도가 surface normal과
@@ -40,13 +49,11 @@ public:
     //    attenuation 없이, 1-R의 확률로 가끔 산란되는 것으로도 구현할 수 있음. (산란되지 않는 레이는 흡수된다고 생각)
     //    아니면 일정한 확률 p로 산란하고 감쇄될 확률은 albedo/p로 설정하는 방법도 있을 것.
     
+    // +++) normal + random_unit_vector()는 cosine-weighted 분포와 같음. 여기서는 normal 주위의 orthonormal basis에서
+    //      cosine-weighted hemisphere를 직접 sampling함. 결과가 항상 unit vector라서 degenerate (zero) direction이 생기지 않음.
+    
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
-        
-        // Catch degenerate scatter direction
-        // random unit vector + normal vector = zero (means exactly opposite) -> leads to (infinities and NaNs).
-        if (scatter_direction.near_zero())
-            scatter_direction = rec.normal;
+        auto scatter_direction = random_cosine_direction(rec.normal);
         
         // Add r_in.time() to track the time of ray intersection.
         scattered = ray(rec.p, scatter_direction, r_in.time());
@@ -58,9 +65,9 @@ private:
     color albedo;
 };
 
-class metal : public material {
+class metal final : public material {
 public:
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color& a, double f) : material(material_kind::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
     
     // Fuzzy Reflection:
     // original endpoint를 중심으로 하는 작은 구에서 ray의 새로운 endpoint를 고름으로써 reflected direction을 randomize 할 수 있음.
@@ -81,9 +88,9 @@ private:
     double fuzz;
 };
 
-class dielectric : public material {
+class dielectric final : public material {
 public:
-    dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+    dielectric(double index_of_refraction) : material(material_kind::dielectric), ir(index_of_refraction) {}
     
     // 물, 유리, 다이아몬드와 같이 투명한 물질들. ray가 hit하면, reflected ray와 refracted(transmitted) ray로 나뉨!
     // interaction당 오직 하나의 scattered ray를 생성하면서 굴절과 반사 중 랜덤하게 선택.
@@ -124,6 +131,21 @@ private:
     }
 };
 
+inline bool scatter_material(const material& m, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+    // Closed-set dispatch: the three classes above are final, so these calls are direct and can be inlined
+    // into a templated render kernel. Materials defined elsewhere still go through the vtable.
+    switch (m.kind) {
+        case material_kind::lambertian:
+            return static_cast<const lambertian&>(m).scatter(r_in, rec, attenuation, scattered);
+        case material_kind::metal:
+            return static_cast<const metal&>(m).scatter(r_in, rec, attenuation, scattered);
+        case material_kind::dielectric:
+            return static_cast<const dielectric&>(m).scatter(r_in, rec, attenuation, scattered);
+        default:
+            return m.scatter(r_in, rec, attenuation, scattered);
+    }
+}
+
 #endif /* MATERIAL_H */
 
 // Note
@@ -0,0 +1,110 @@
+//
+//  obj_loader.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "rtweekend.h"
+
+#include "triangle_mesh.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+inline bool load_obj(const std::string& path, mesh_data& mesh) {
+    // Streaming Wavefront OBJ reader: the file is read one line at a time into a fixed buffer, so only the
+    // vertex and index arrays grow with the file. Uses 'v' and 'f' statements; faces with more than three
+    // corners are fanned into triangles. Normals, texture coordinates, groups and materials are skipped.
+    FILE* f = std::fopen(path.c_str(), "r");
+    if (!f) {
+        std::clog << "Cannot open OBJ file " << path << ".\n";
+        return false;
+    }
+
+    auto first_vertex = static_cast<long>(mesh.vertex_count());
+    std::vector<uint32_t> corners;
+    char line[4096];
+    size_t line_number = 0;
+    bool ok = true;
+
+    while (ok && std::fgets(line, sizeof(line), f)) {
+        line_number++;
+        auto length = std::strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            std::clog << path << ":" << line_number << ": line too long.\n";
+            ok = false;
+            break;
+        }
+
+        const char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            char* end;
+            double v[3];
+            p += 2;
+            for (int a = 0; a < 3 && ok; a++) {
+                v[a] = std::strtod(p, &end);
+                ok = (end != p);
+                p = end;
+            }
+            if (!ok) {
+                std::clog << path << ":" << line_number << ": malformed vertex.\n";
+                break;
+            }
+            mesh.add_vertex(point3(v[0], v[1], v[2]));
+        } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            // Each corner is v, v/vt, v//vn or v/vt/vn; only v is used. Negative indices count back from the end.
+            corners.clear();
+            p += 2;
+            while (true) {
+                char* end;
+                long index = std::strtol(p, &end, 10);
+                if (end == p)
+                    break;
+                p = end;
+                while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                    p++;
+
+                long count = static_cast<long>(mesh.vertex_count());
+                long resolved = (index < 0) ? count + index : first_vertex + index - 1;
+                if (index == 0 || resolved < 0 || resolved >= count) {
+                    std::clog << path << ":" << line_number << ": face refers to a missing vertex.\n";
+                    ok = false;
+                    break;
+                }
+                corners.push_back(static_cast<uint32_t>(resolved));
+            }
+            if (ok && corners.size() < 3) {
+                std::clog << path << ":" << line_number << ": face needs at least three vertices.\n";
+                ok = false;
+            }
+            for (size_t k = 2; ok && k < corners.size(); k++)
+                mesh.add_triangle(corners[0], corners[k-1], corners[k]);
+        }
+    }
+
+    if (ok && std::ferror(f)) {
+        std::clog << "Read error in " << path << ".\n";
+        ok = false;
+    }
+    std::fclose(f);
+
+    if (ok) {
+        mesh.x.shrink_to_fit();
+        mesh.y.shrink_to_fit();
+        mesh.z.shrink_to_fit();
+        mesh.indices.shrink_to_fit();
+    }
+    return ok;
+}
+
+#endif /* OBJ_LOADER_H */
@@ -0,0 +1,576 @@
+//
+//  paged_bvh.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef PAGED_BVH_H
+#define PAGED_BVH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "scene_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Out-of-core scene format (.rttree)
+// The BVH of a scene_data is cut into treelets: connected pieces of the tree that fit in one fixed-size page
+// together with the spheres of their leaves. Where the tree continues in another treelet, the page holds a
+// link node with that treelet's box. Only the header, camera and materials are read up front; treelet pages
+// are mapped one at a time when a ray first needs them and unmapped again by an LRU cache of bounded size.
+//
+//   paged_bvh_header
+//   scene_camera_record
+//   scene_material_record[material_count]
+//   page[treelet_count]                   (page_size bytes each, treelet 0 holds the root)
+//
+// A page is a paged_bvh_page_header, then scene_bvh_record[node_count] in depth-first order (local node 0 is
+// the treelet root), then scene_sphere_record[sphere_count]. Leaf offsets index the page's own spheres.
+
+const uint32_t paged_bvh_version = 1;
+const char paged_bvh_magic[8] = {'R','T','T','R','E','E','\0','\0'};
+const uint16_t paged_bvh_link = 0xffff;    // scene_bvh_record::count of a link node; offset is the treelet id
+
+struct paged_bvh_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t camera_offset;
+    uint64_t material_offset, material_count;
+    uint64_t treelet_offset, treelet_count;
+    uint32_t page_size;
+    uint32_t reserved;
+    float    bmin[3], bmax[3];
+};
+
+struct paged_bvh_page_header {
+    uint32_t node_count;
+    uint32_t sphere_count;
+    uint32_t reserved[6];   // keeps the records after it 32-byte aligned
+};
+
+static_assert(sizeof(paged_bvh_page_header) == 32, "paged_bvh_page_header layout changed");
+
+
+inline bool write_paged_bvh(const scene_data& scene, const std::string& path, uint32_t page_size = 65536) {
+    // Splits scene.nodes (scene_data::build_bvh must have run) into treelets. Each treelet is grown breadth
+    // first from its root while the page has room, so the top of every treelet is dense and the cut
+    // happens near its bottom; children that no longer fit become links and roots of later treelets.
+    if (scene.nodes.empty()) {
+        std::clog << "Scene has no BVH to page.\n";
+        return false;
+    }
+    if (page_size < 4096 || page_size % 4096 != 0) {
+        std::clog << "Treelet page size must be a multiple of 4096 bytes.\n";
+        return false;
+    }
+
+    const auto& nodes = scene.nodes;
+    const auto spheres = scene.sphere_records();
+    const auto materials = scene.material_records();
+    const auto node_bytes = sizeof(scene_bvh_record), sphere_bytes = sizeof(scene_sphere_record);
+    std::vector<uint32_t> owner(nodes.size(), ~0u);
+    std::vector<uint32_t> roots(1, 0);
+
+    paged_bvh_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, paged_bvh_magic, sizeof(header.magic));
+    header.version = paged_bvh_version;
+    header.header_size = sizeof(paged_bvh_header);
+    header.page_size = page_size;
+    auto align = [](uint64_t offset) { return (offset + 63) & ~uint64_t(63); };
+    header.camera_offset = align(sizeof(paged_bvh_header));
+    header.material_offset = align(header.camera_offset + sizeof(scene_camera_record));
+    header.material_count = scene.materials.size();
+    auto materials_end = header.material_offset + scene.materials.size() * sizeof(scene_material_record);
+    header.treelet_offset = (materials_end + page_size - 1) / page_size * page_size;
+    for (int a = 0; a < 3; a++) {
+        header.bmin[a] = nodes[0].bmin[a];
+        header.bmax[a] = nodes[0].bmax[a];
+    }
+
+    std::string tmp_path = path + ".tmp";
+    FILE* f = std::fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        std::clog << "Cannot open " << tmp_path << " for writing.\n";
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<unsigned char> page(page_size);
+    std::vector<scene_bvh_record> local_nodes;
+    std::vector<scene_sphere_record> local_spheres;
+
+    for (uint32_t t = 0; ok && t < roots.size(); t++) {
+        // Choose the nodes of treelet t. The root's slot is paid for up front; an inner node pays for the
+        // slots of its two children, a leaf for its spheres.
+        size_t used = sizeof(paged_bvh_page_header) + node_bytes;
+        std::deque<uint32_t> frontier(1, roots[t]);
+        while (!frontier.empty()) {
+            auto g = frontier.front();
+            frontier.pop_front();
+            const auto& n = nodes[g];
+            size_t extra = (n.count > 0) ? n.count * sphere_bytes : 2 * node_bytes;
+            if (used + extra > page_size) {
+                if (g == roots[t]) {
+                    std::clog << "A BVH leaf doesn't fit in a " << page_size << "-byte treelet page.\n";
+                    ok = false;
+                }
+                continue;   // stays a link
+            }
+            used += extra;
+            owner[g] = t;
+            if (n.count == 0) {
+                frontier.push_back(g + 1);
+                frontier.push_back(n.offset);
+            }
+        }
+        if (!ok)
+            break;
+
+        // Emit it depth first; anything outside the treelet becomes a link to a new treelet.
+        local_nodes.clear();
+        local_spheres.clear();
+        std::vector<uint32_t> stack(1, roots[t]);
+        std::vector<uint32_t> fixups;   // local inner nodes whose right child comes next, in stack order
+        while (!stack.empty()) {
+            auto g = stack.back();
+            stack.pop_back();
+            if (g == ~0u) {
+                // Marker: the left subtree of fixups.back() is done, its right child is the next node.
+                local_nodes[fixups.back()].offset = static_cast<uint32_t>(local_nodes.size());
+                fixups.pop_back();
+                continue;
+            }
+
+            auto node = nodes[g];
+            if (owner[g] != t) {
+                node.offset = static_cast<uint32_t>(roots.size());
+                node.count = paged_bvh_link;
+                node.axis = 0;
+                roots.push_back(g);
+            } else if (node.count > 0) {
+                auto first = node.offset;
+                node.offset = static_cast<uint32_t>(local_spheres.size());
+                local_spheres.insert(local_spheres.end(), spheres.begin() + first, spheres.begin() + first + node.count);
+            } else {
+                fixups.push_back(static_cast<uint32_t>(local_nodes.size()));
+                stack.push_back(nodes[g].offset);
+                stack.push_back(~0u);
+                stack.push_back(g + 1);
+            }
+            local_nodes.push_back(node);
+        }
+
+        paged_bvh_page_header page_header;
+        std::memset(&page_header, 0, sizeof(page_header));
+        page_header.node_count = static_cast<uint32_t>(local_nodes.size());
+        page_header.sphere_count = static_cast<uint32_t>(local_spheres.size());
+
+        std::fill(page.begin(), page.end(), 0);
+        auto* p = page.data();
+        std::memcpy(p, &page_header, sizeof(page_header));
+        p += sizeof(page_header);
+        std::memcpy(p, local_nodes.data(), local_nodes.size() * node_bytes);
+        p += local_nodes.size() * node_bytes;
+        std::memcpy(p, local_spheres.data(), local_spheres.size() * sphere_bytes);
+
+        ok = std::fseek(f, static_cast<long>(header.treelet_offset + uint64_t(t) * page_size), SEEK_SET) == 0
+          && std::fwrite(page.data(), 1, page_size, f) == page_size;
+    }
+
+    header.treelet_count = roots.size();
+    header.file_size = header.treelet_offset + header.treelet_count * page_size;
+
+    auto write_at = [f](uint64_t offset, const void* data, size_t size) {
+        return size == 0 || (std::fseek(f, static_cast<long>(offset), SEEK_SET) == 0 && std::fwrite(data, 1, size, f) == size);
+    };
+    ok = ok && write_at(0, &header, sizeof(header))
+            && write_at(header.camera_offset, &scene.camera, sizeof(scene.camera))
+            && write_at(header.material_offset, materials.data(), materials.size() * sizeof(scene_material_record));
+    ok = (std::fclose(f) == 0) && ok;
+
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::clog << "Failed to write treelet file " << path << ".\n";
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    std::clog << "Wrote " << header.treelet_count << " treelets of " << page_size << " bytes to " << path << ".\n";
+    return true;
+}
+
+
+class paged_bvh final : public hittable {
+public:
+    // Renders a .rttree file with at most cache_bytes of treelet pages mapped at a time.
+    // hit() traces one ray and pages treelets in as it reaches them; trace() takes a batch of rays and
+    // queues them per treelet, so every page that is brought in is used by all the rays waiting for it.
+
+    paged_bvh() {}
+    paged_bvh(const paged_bvh&) = delete;
+    paged_bvh& operator=(const paged_bvh&) = delete;
+
+    ~paged_bvh() { close(); }
+
+    bool open(const std::string& path, size_t cache_bytes = size_t(256) << 20) {
+        close();
+
+        file_path = path;
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::clog << "Cannot open treelet file " << path << ".\n";
+            return false;
+        }
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0
+               && read_at(0, &header, sizeof(header))
+               && valid_header(static_cast<uint64_t>(st.st_size));
+        if (ok) {
+            std::vector<scene_material_record> records(header.material_count);
+            ok = read_at(header.camera_offset, &cam, sizeof(cam))
+              && read_at(header.material_offset, records.data(), records.size() * sizeof(scene_material_record));
+            materials.build(records.data(), records.size());
+        }
+        if (!ok) {
+            std::clog << "Treelet file " << path << " is not a version " << paged_bvh_version << " .rttree file.\n";
+            close();
+            return false;
+        }
+
+        capacity = cache_bytes / header.page_size;
+        if (capacity < 1)
+            capacity = 1;
+        bbox = aabb(point3(header.bmin[0], header.bmin[1], header.bmin[2]),
+                    point3(header.bmax[0], header.bmax[1], header.bmax[2]));
+
+        // Every ray starts in treelet 0, so a damaged root page fails here rather than rendering nothing.
+        // Other pages are checked as they are first mapped.
+        if (!acquire(0)) {
+            close();
+            return false;
+        }
+        release(0);
+        return true;
+    }
+
+    void close() {
+        for (auto& entry : resident)
+            munmap(const_cast<unsigned char*>(entry.second.page), header.page_size);
+        resident.clear();
+        lru.clear();
+        damaged.clear();
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        loads = evictions = 0;
+        std::memset(&header, 0, sizeof(header));
+    }
+
+    const scene_camera_record& camera_settings() const { return cam; }
+    size_t treelet_count() const { return header.treelet_count; }
+    size_t cache_pages() const { return capacity; }
+    size_t page_loads() const { return loads; }
+    size_t page_evictions() const { return evictions; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        ray_query query(r, ray_t);
+        std::vector<uint32_t> pending(1, 0), links;
+        while (!pending.empty()) {
+            auto id = pending.back();
+            pending.pop_back();
+
+            const auto* page = acquire(id);
+            links.clear();
+            traverse(page, query, links);
+            release(id);
+            pending.insert(pending.end(), links.begin(), links.end());
+        }
+        if (query.hit)
+            rec = query.rec;
+        return query.hit;
+    }
+
+    void trace(std::vector<ray_query>& queries) const {
+        // Rays wait in per-treelet queues. A treelet that is already resident is always drained first;
+        // otherwise the longest queue is loaded next, so each page load is shared by as many rays as possible.
+        // A ray queued for a treelet before it found a closer hit elsewhere is culled by the treelet's root box.
+        std::unordered_map<uint32_t, std::vector<uint32_t>> queues;
+        auto& root = queues[0];
+        for (uint32_t k = 0; k < queries.size(); k++) {
+            queries[k].hit = false;
+            root.push_back(k);
+        }
+
+        std::vector<uint32_t> links;
+        while (!queues.empty()) {
+            auto next = queues.begin();
+            for (auto it = queues.begin(); it != queues.end(); ++it) {
+                if (is_resident(it->first)) {
+                    next = it;
+                    break;
+                }
+                if (it->second.size() > next->second.size())
+                    next = it;
+            }
+            auto id = next->first;
+            auto batch = std::move(next->second);
+            queues.erase(next);
+
+            const auto* page = acquire(id);
+            for (auto k : batch) {
+                links.clear();
+                traverse(page, queries[k], links);
+                for (auto link : links)
+                    queues[link].push_back(k);
+            }
+            release(id);
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    struct cache_entry {
+        const unsigned char* page;
+        int pins;
+        std::list<uint32_t>::iterator position;   // in lru, most recently used first
+    };
+
+    int fd = -1;
+    paged_bvh_header header;
+    scene_camera_record cam;
+    material_table materials;
+    aabb bbox;
+
+    // The page cache. It is shared by every ray and guarded by one mutex; a page is never unmapped while
+    // pinned, so the cache may briefly run over capacity when every resident page is in use.
+    mutable std::mutex cache_lock;
+    mutable std::unordered_map<uint32_t, cache_entry> resident;
+    mutable std::list<uint32_t> lru;
+    mutable std::unordered_set<uint32_t> damaged;   // treelets whose page failed valid_page, never mapped again
+    mutable size_t loads = 0, evictions = 0;
+    size_t capacity = 0;
+    std::string file_path;
+
+    static const int max_stack = 64;
+    static const int max_tree_depth = max_stack - 2;
+
+    bool read_at(uint64_t offset, void* data, size_t size) const {
+        return size == 0 || pread(fd, data, size, static_cast<off_t>(offset)) == static_cast<ssize_t>(size);
+    }
+
+    bool valid_header(uint64_t actual_size) const {
+        if (std::memcmp(header.magic, paged_bvh_magic, sizeof(header.magic)) != 0)  return false;
+        if (header.version != paged_bvh_version || header.header_size != sizeof(paged_bvh_header))  return false;
+        if (header.file_size != actual_size || header.treelet_count == 0)  return false;
+
+        auto system_page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        if (header.page_size < sizeof(paged_bvh_page_header) || header.page_size % system_page != 0)  return false;
+        if (header.treelet_offset % system_page != 0)  return false;
+        if (header.camera_offset + sizeof(scene_camera_record) > actual_size)  return false;
+        if (header.material_count > actual_size / sizeof(scene_material_record))  return false;
+        if (header.material_offset + header.material_count * sizeof(scene_material_record) > header.treelet_offset)  return false;
+        return header.treelet_count <= (actual_size - header.treelet_offset) / header.page_size;
+    }
+
+    bool is_resident(uint32_t id) const {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        return resident.count(id) != 0;
+    }
+
+    const unsigned char* acquire(uint32_t id) const {
+        // Returns the page of treelet id, pinned until release(id). A page that can't be mapped or fails
+        // valid_page is returned as nullptr, which traverse() treats as an empty treelet.
+        std::lock_guard<std::mutex> guard(cache_lock);
+        if (damaged.count(id) != 0)
+            return nullptr;
+        auto found = resident.find(id);
+        if (found != resident.end()) {
+            lru.splice(lru.begin(), lru, found->second.position);
+            found->second.pins++;
+            return found->second.page;
+        }
+
+        // Evict least recently used pages that nobody is reading.
+        auto victim = lru.end();
+        while (resident.size() >= capacity && victim != lru.begin()) {
+            --victim;
+            auto entry = resident.find(*victim);
+            if (entry->second.pins > 0)
+                continue;
+            munmap(const_cast<unsigned char*>(entry->second.page), header.page_size);
+            resident.erase(entry);
+            victim = lru.erase(victim);
+            evictions++;
+        }
+
+        const unsigned char* page = nullptr;
+        if (id < header.treelet_count) {
+            auto offset = static_cast<off_t>(header.treelet_offset + uint64_t(id) * header.page_size);
+            void* mapped = mmap(nullptr, header.page_size, PROT_READ, MAP_PRIVATE, fd, offset);
+            if (mapped != MAP_FAILED) {
+                page = static_cast<const unsigned char*>(mapped);
+                if (!valid_page(page, id)) {
+                    munmap(mapped, header.page_size);
+                    page = nullptr;
+                }
+            }
+        }
+        if (!page) {
+            if (damaged.insert(id).second)
+                std::clog << "Treelet " << id << " of " << file_path << " is damaged, its geometry is skipped.\n";
+            return nullptr;
+        }
+
+        lru.push_front(id);
+        resident[id] = cache_entry{page, 1, lru.begin()};
+        loads++;
+        return page;
+    }
+
+    bool valid_page(const unsigned char* page, uint32_t id) const {
+        // The counts fit the page, and the treelet is a tree traverse() can walk: every child after its parent
+        // (depth-first order, so no cycles inside the page) and no node reached twice, a split axis of 0-2,
+        // leaves inside the page's spheres, links only to later treelets (so no cycles between pages), and no
+        // path deeper than the traversal stack allows. write_paged_bvh's treelets always pass.
+        const auto* page_header = reinterpret_cast<const paged_bvh_page_header*>(page);
+        const auto* nodes = reinterpret_cast<const scene_bvh_record*>(page + sizeof(paged_bvh_page_header));
+        uint64_t node_count = page_header->node_count, sphere_count = page_header->sphere_count;
+        uint64_t bytes = sizeof(paged_bvh_page_header) + node_count * sizeof(scene_bvh_record)
+                       + sphere_count * sizeof(scene_sphere_record);
+        if (node_count == 0 || bytes > header.page_size)
+            return false;
+
+        struct entry { uint64_t node; int depth; };
+        std::vector<entry> pending(1, entry{0, 0});
+        std::vector<bool> reached(node_count, false);
+        while (!pending.empty()) {
+            auto current = pending.back();
+            pending.pop_back();
+            if (current.depth > max_tree_depth || reached[current.node])
+                return false;
+            reached[current.node] = true;
+            const auto& node = nodes[current.node];
+            if (node.count == paged_bvh_link) {
+                if (node.offset <= id || node.offset >= header.treelet_count)
+                    return false;
+                continue;
+            }
+            if (node.count > 0) {
+                if (uint64_t(node.offset) + node.count > sphere_count)
+                    return false;
+                continue;
+            }
+            uint64_t left = current.node + 1, right = node.offset;
+            if (node.axis > 2 || left >= node_count || right <= left || right >= node_count)
+                return false;
+            pending.push_back(entry{left, current.depth + 1});
+            pending.push_back(entry{right, current.depth + 1});
+        }
+        return true;
+    }
+
+    void release(uint32_t id) const {
+        std::lock_guard<std::mutex> guard(cache_lock);
+        auto found = resident.find(id);
+        if (found != resident.end())
+            found->second.pins--;
+    }
+
+    void traverse(const unsigned char* page, ray_query& query, std::vector<uint32_t>& links) const {
+        // Closest hit inside one treelet, shrinking query.ray_t as hits are found.
+        // Link nodes whose box the ray enters are handed back through links instead of being followed.
+        if (!page)
+            return;
+        const auto* page_header = reinterpret_cast<const paged_bvh_page_header*>(page);
+        const auto* nodes = reinterpret_cast<const scene_bvh_record*>(page + sizeof(paged_bvh_page_header));
+        const auto* spheres = reinterpret_cast<const scene_sphere_record*>(nodes + page_header->node_count);
+
+        const auto& r = query.r;
+        const double orig[3] = { r.origin().x(), r.origin().y(), r.origin().z() };
+        const double inv_dir[3] = { 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() };
+
+        // valid_page() has checked every index this reads, and that the treelet is shallow enough for the stack:
+        // depth-first, the stack never holds more than one node per level plus the one being visited.
+        uint32_t stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+
+        const scene_sphere_record* closest = nullptr;
+        while (top > 0) {
+            auto index = stack[--top];
+            const auto& node = nodes[index];
+            if (!hit_box(node, orig, inv_dir, query.ray_t))
+                continue;
+
+            if (node.count == paged_bvh_link) {
+                links.push_back(node.offset);
+            } else if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    if (hit_sphere_record(spheres[i], r, query.ray_t, query.rec)) {
+                        query.ray_t.max = query.rec.t;
+                        closest = &spheres[i];
+                    }
+                }
+            } else {
+                uint32_t left = index + 1;
+                uint32_t right = node.offset;
+                if (inv_dir[node.axis] < 0) {
+                    stack[top++] = left;
+                    stack[top++] = right;
+                } else {
+                    stack[top++] = right;
+                    stack[top++] = left;
+                }
+            }
+        }
+
+        if (closest) {
+            // The material is looked up now: the page, and closest with it, may be unmapped after release().
+            query.rec.mat = materials.get(closest->material);
+            query.hit = true;
+        }
+    }
+
+    static bool hit_box(const scene_bvh_record& node, const double* orig, const double* inv_dir, interval ray_t) {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (node.bmin[a] - orig[a]) * inv_dir[a];
+            auto t1 = (node.bmax[a] - orig[a]) * inv_dir[a];
+            if (inv_dir[a] < 0)
+                std::swap(t0, t1);
+
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif /* PAGED_BVH_H */
+
+// Note
+// 메모리에 다 들어가지 않는 씬을 위해 BVH를 page 크기의 treelet으로 잘라서 파일에 두고, 필요할 때만 mmap해서 사용함.
+// LRU cache가 mapping된 page 수를 제한하고, 오래 쓰이지 않은 treelet부터 munmap함.
+// Ray by ray traversal would fault pages in and out constantly; trace() instead parks rays at each link until that treelet
+// is loaded, which is why camera::render_batched hands it a whole scanline of rays at once.
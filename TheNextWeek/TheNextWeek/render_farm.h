@@ -0,0 +1,442 @@
+//
+//  render_farm.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef RENDER_FARM_H
+#define RENDER_FARM_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// One render split across processes: a coordinator owns the framebuffer and hands out tiles as work units, and
+// workers (any number, on this or other hosts, each with the same scene and camera) trace them and send back the
+// accumulated samples, which the coordinator adds to the framebuffer exactly as a local render thread would.
+//
+// Addresses are a UNIX socket path (anything with a '/') or host:port for TCP.
+// Every message is a farm_message_header followed by `length` bytes:
+//   hello   worker -> coordinator   uint64 job_key (camera::job_key(): both ends must render the same view)
+//   unit    coordinator -> worker   uint32 id, int32 x0, y0, x1, y1, target, then first sample of each tile row
+//   result  worker -> coordinator   uint32 id, int32 x0, y0, x1, y1, then samples of each row, then per pixel
+//                                   sum r, g, b and luminance_sq as doubles
+//   done    coordinator -> worker   nothing left (or the job_key didn't match); the worker disconnects
+// Values are in the sender's byte order: all machines of a farm are assumed to share one architecture.
+static const uint32_t farm_magic = 0x4d524146;     // "FARM"
+
+enum farm_message_type : uint32_t {
+    farm_hello = 1,
+    farm_unit,
+    farm_result,
+    farm_done,
+};
+
+struct farm_message_header {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t length;
+};
+
+struct farm_work {
+    // A unit (first_sample per row, to be traced up to target) or its result (samples per row and the values).
+    uint32_t id = 0;
+    image_tile tile = {0, 0, 0, 0};
+    int target = 0;
+    std::vector<int> rows;
+    std::vector<double> values;     // 4 per pixel: sum r, g, b, luminance_sq
+};
+
+namespace farm_detail {
+
+inline int open_socket(const std::string& address, bool listening) {
+    // Listening or connected socket for a UNIX path or host:port; -1 (and a message) on failure.
+    if (address.find('/') != std::string::npos) {
+        sockaddr_un where;
+        std::memset(&where, 0, sizeof(where));
+        where.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(where.sun_path)) {
+            std::clog << "Socket path " << address << " is too long.\n";
+            return -1;
+        }
+        std::strcpy(where.sun_path, address.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listening)
+            unlink(address.c_str());
+        bool ok = fd >= 0 && (listening ? bind(fd, reinterpret_cast<sockaddr*>(&where), sizeof(where)) == 0 && listen(fd, 64) == 0
+                                        : connect(fd, reinterpret_cast<sockaddr*>(&where), sizeof(where)) == 0);
+        if (!ok && fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    auto colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::clog << "Address " << address << " is neither a socket path nor host:port.\n";
+        return -1;
+    }
+    std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+    addrinfo hints, *found = nullptr;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0) {
+        std::clog << "Cannot resolve " << address << ".\n";
+        return -1;
+    }
+    int fd = -1;
+    for (auto* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        bool ok = listening ? bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, 64) == 0
+                            : connect(fd, a->ai_addr, a->ai_addrlen) == 0;
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+inline bool send_all(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        p += sent;
+        n -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t n) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t got = recv(fd, p, n, 0);
+        if (got <= 0)
+            return false;
+        p += got;
+        n -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+inline bool send_message(int fd, farm_message_type type, const std::vector<char>& payload) {
+    farm_message_header header = {farm_magic, type, payload.size()};
+    return send_all(fd, &header, sizeof(header)) && (payload.empty() || send_all(fd, payload.data(), payload.size()));
+}
+
+template <typename T>
+void put(std::vector<char>& out, const T* data, size_t count) {
+    const char* p = reinterpret_cast<const char*>(data);
+    out.insert(out.end(), p, p + count * sizeof(T));
+}
+
+inline std::vector<char> encode(const farm_work& work) {
+    std::vector<char> out;
+    int32_t fields[5] = {work.tile.x0, work.tile.y0, work.tile.x1, work.tile.y1, work.target};
+    put(out, &work.id, 1);
+    put(out, fields, 5);
+    put(out, work.rows.data(), work.rows.size());
+    put(out, work.values.data(), work.values.size());
+    return out;
+}
+
+inline bool decode(const char* data, size_t n, bool with_values, farm_work& work) {
+    // Checks that the sizes agree with the tile, so a corrupt message can't index outside the image.
+    const size_t fixed = sizeof(uint32_t) + 5 * sizeof(int32_t);
+    if (n < fixed)
+        return false;
+    int32_t fields[5];
+    std::memcpy(&work.id, data, sizeof(uint32_t));
+    std::memcpy(fields, data + sizeof(uint32_t), sizeof(fields));
+    work.tile = image_tile{fields[0], fields[1], fields[2], fields[3]};
+    work.target = fields[4];
+    if (work.tile.x1 <= work.tile.x0 || work.tile.y1 <= work.tile.y0)
+        return false;
+    // In 64 bits, and no larger than the payload, so neither the differences nor the product can overflow.
+    auto rows = static_cast<size_t>(int64_t(work.tile.y1) - work.tile.y0);
+    auto columns = static_cast<size_t>(int64_t(work.tile.x1) - work.tile.x0);
+    if (rows > n || (with_values && columns > n))
+        return false;
+    size_t values = with_values ? rows * columns * 4 : 0;
+    if (n != fixed + rows * sizeof(int) + values * sizeof(double))
+        return false;
+    work.rows.resize(rows);
+    work.values.resize(values);
+    std::memcpy(work.rows.data(), data + fixed, rows * sizeof(int));
+    if (values)
+        std::memcpy(work.values.data(), data + fixed + rows * sizeof(int), values * sizeof(double));
+    return true;
+}
+
+} // namespace farm_detail
+
+
+class farm_worker_link {
+public:
+    // A worker's connection to the coordinator: one unit at a time. A worker process opens one per render thread.
+
+    farm_worker_link() {}
+    farm_worker_link(const farm_worker_link&) = delete;
+    farm_worker_link& operator=(const farm_worker_link&) = delete;
+
+    ~farm_worker_link() {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool connect(const std::string& address, uint64_t job_key, double wait_seconds) {
+        // Retries for wait_seconds, so workers may be started before the coordinator.
+        auto give_up = std::chrono::steady_clock::now() + std::chrono::duration<double>(wait_seconds);
+        while ((fd = farm_detail::open_socket(address, false)) < 0 && std::chrono::steady_clock::now() < give_up)
+            usleep(100 * 1000);
+        if (fd < 0) {
+            std::clog << "Cannot reach coordinator at " << address << ".\n";
+            return false;
+        }
+        std::vector<char> hello;
+        farm_detail::put(hello, &job_key, 1);
+        return farm_detail::send_message(fd, farm_hello, hello);
+    }
+
+    bool next(farm_work& unit) {
+        // The next unit; false when the coordinator is done with this worker or gone.
+        farm_message_header header;
+        if (!farm_detail::recv_all(fd, &header, sizeof(header)) || header.magic != farm_magic || header.type != farm_unit
+            || header.length > (64u << 20))
+            return false;
+        std::vector<char> payload(header.length);
+        return farm_detail::recv_all(fd, payload.data(), payload.size())
+            && farm_detail::decode(payload.data(), payload.size(), false, unit);
+    }
+
+    bool send(const farm_work& result) {
+        return farm_detail::send_message(fd, farm_result, farm_detail::encode(result));
+    }
+
+private:
+    int fd = -1;
+};
+
+
+class farm_coordinator {
+public:
+    // Hands units to workers and collects their results on one thread with poll(). A unit goes back to the front of
+    // the queue when its worker disconnects; a unit that has been out longer than unit_timeout is also handed to
+    // the next idle worker, and whichever result comes first counts (a slow worker's late copy is dropped).
+
+    farm_coordinator() {}
+    farm_coordinator(const farm_coordinator&) = delete;
+    farm_coordinator& operator=(const farm_coordinator&) = delete;
+
+    ~farm_coordinator() {
+        for (auto& c : links)
+            close(c.fd);
+        if (listener >= 0)
+            close(listener);
+    }
+
+    bool listen(const std::string& address) {
+        listener = farm_detail::open_socket(address, true);
+        if (listener < 0) {
+            std::clog << "Cannot listen on " << address << ".\n";
+            return false;
+        }
+        fcntl(listener, F_SETFL, O_NONBLOCK);
+        return true;
+    }
+
+    template <typename commit_function, typename tick_function>
+    void run(const std::vector<farm_work>& work, uint64_t job_key, double unit_timeout,
+             commit_function commit, tick_function tick) {
+        // commit(result) is called once per unit, tick() at least twice a second (progress, checkpoints).
+        // Returns when every unit has been committed.
+        typedef std::chrono::steady_clock clock;
+        units = &work;
+        done.assign(work.size(), false);
+        started.assign(work.size(), clock::now());
+        queue.clear();
+        for (size_t u = 0; u < work.size(); ++u)
+            queue.push_back(u);
+        size_t remaining = work.size();
+
+        while (remaining > 0) {
+            std::vector<pollfd> fds(1, pollfd{listener, POLLIN, 0});
+            for (auto& c : links)
+                fds.push_back(pollfd{c.fd, POLLIN, 0});
+            poll(fds.data(), fds.size(), 500);
+
+            if (fds[0].revents & POLLIN)
+                accept_workers();
+            for (size_t k = 1; k < fds.size(); ++k) {
+                auto& c = links[k - 1];
+                if (fds[k].revents & (POLLIN | POLLHUP | POLLERR))
+                    receive(c, job_key, commit, remaining);
+            }
+
+            // Give idle workers units: queued ones first, then copies of overdue ones.
+            auto now = clock::now();
+            for (auto& c : links) {
+                if (c.fd < 0 || !c.greeted || c.unit >= 0)
+                    continue;
+                long u = take_unit();
+                if (u < 0) {
+                    for (size_t v = 0; v < work.size() && u < 0; ++v)
+                        if (!done[v] && std::chrono::duration<double>(now - started[v]).count() > unit_timeout)
+                            u = static_cast<long>(v);
+                    if (u >= 0)
+                        std::clog << "\rUnit " << u << " is overdue; also giving it to another worker.\n";
+                }
+                if (u < 0)
+                    break;
+                started[u] = now;
+                c.unit = u;
+                if (!farm_detail::send_message(c.fd, farm_unit, farm_detail::encode(work[u])))
+                    drop(c);
+            }
+            links.erase(std::remove_if(links.begin(), links.end(), [](const link& c) { return c.fd < 0; }), links.end());
+            tick();
+        }
+
+        for (auto& c : links) {
+            farm_detail::send_message(c.fd, farm_done, std::vector<char>());
+            close(c.fd);
+        }
+        links.clear();
+    }
+
+private:
+    struct link {
+        int fd = -1;
+        bool greeted = false;
+        long unit = -1;             // the unit it is working on
+        std::vector<char> input;    // bytes received but not yet a whole message
+    };
+
+    int listener = -1;
+    std::vector<link> links;
+    const std::vector<farm_work>* units = nullptr;
+    std::vector<bool> done;
+    std::vector<std::chrono::steady_clock::time_point> started;
+    std::deque<size_t> queue;
+
+    void accept_workers() {
+        for (int fd; (fd = accept(listener, nullptr, nullptr)) >= 0; ) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            link c;
+            c.fd = fd;
+            links.push_back(c);
+        }
+    }
+
+    long take_unit() {
+        while (!queue.empty()) {
+            size_t u = queue.front();
+            queue.pop_front();
+            if (!done[u])
+                return static_cast<long>(u);
+        }
+        return -1;
+    }
+
+    void drop(link& c) {
+        // The worker is gone: its unit goes back to the front of the queue.
+        if (c.unit >= 0 && !done[c.unit])
+            queue.push_front(static_cast<size_t>(c.unit));
+        close(c.fd);
+        c.fd = -1;
+        c.unit = -1;
+    }
+
+    template <typename commit_function>
+    void receive(link& c, uint64_t job_key, commit_function& commit, size_t& remaining) {
+        char buffer[1 << 16];
+        for (;;) {
+            ssize_t got = recv(c.fd, buffer, sizeof(buffer), 0);
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                drop(c);
+                return;
+            }
+            if (got < 0)
+                break;
+            c.input.insert(c.input.end(), buffer, buffer + got);
+        }
+
+        while (c.input.size() >= sizeof(farm_message_header)) {
+            farm_message_header header;
+            std::memcpy(&header, c.input.data(), sizeof(header));
+            if (header.magic != farm_magic || header.length > (64u << 20)) {
+                drop(c);
+                return;
+            }
+            if (c.input.size() < sizeof(header) + header.length)
+                return;
+            const char* payload = c.input.data() + sizeof(header);
+
+            if (header.type == farm_hello && header.length == sizeof(uint64_t)) {
+                uint64_t key;
+                std::memcpy(&key, payload, sizeof(key));
+                if (key != job_key) {
+                    std::clog << "\rA worker with a different camera connected; sent it away.\n";
+                    farm_detail::send_message(c.fd, farm_done, std::vector<char>());
+                    drop(c);
+                    return;
+                }
+                c.greeted = true;
+            } else if (header.type == farm_result) {
+                farm_work result;
+                bool valid = c.unit >= 0 && farm_detail::decode(payload, header.length, true, result)
+                          && result.id == (*units)[c.unit].id
+                          && std::memcmp(&result.tile, &(*units)[c.unit].tile, sizeof(image_tile)) == 0;
+                if (!valid) {
+                    drop(c);
+                    return;
+                }
+                if (!done[c.unit]) {
+                    done[c.unit] = true;
+                    remaining--;
+                    commit(result);
+                }
+                c.unit = -1;
+            } else {
+                drop(c);
+                return;
+            }
+            c.input.erase(c.input.begin(), c.input.begin() + sizeof(header) + header.length);
+        }
+    }
+};
+
+#endif /* RENDER_FARM_H */
+
+// Note
+// 여러 host (또는 한 host의 여러 process)로 하나의 렌더를 나눔. coordinator가 framebuffer를 가지고 tile 단위로 일을 나눠 줌.
+// worker는 tile의 sample 합과 luminance_sq를 그대로 돌려주고, coordinator는 로컬 render thread처럼 framebuffer에 add 함.
+// Seeding depends only on the tile and its first sample, so the image is the same as a local render however the units were spread.
+// 같은 machine의 worker들은 .rtscene 파일을 read-only mmap 하면 page cache로 scene을 공유함.
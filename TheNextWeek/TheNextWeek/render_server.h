@@ -0,0 +1,573 @@
+//
+//  render_server.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "image_writer.h"
+#include "render_farm.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// A long-lived render process. Clients connect to its socket (UNIX path or host:port, as for render_farm.h) and
+// send one request line of key=value words:
+//   scene=<builtin | file.rtscene | text scene> output=<file.png>
+//   and optionally spp, width, max_depth, vfov, defocus_angle, focus_dist, lookfrom=x,y,z, lookat=x,y,z,
+//   vup=x,y,z, hdr=<file.pfm>, priority=<n> (share of the threads; default 1, clamped to [0.1, 10])
+// The reply is one line once the PNG is on disk:
+//   done <output> scene=hit|miss wait_ms=<until the first tile was traced> seconds=<total>
+// or `error <reason>`.
+// Anyone who can reach the socket can send requests, so a served request's scene (other than builtin), output and
+// hdr must be relative paths without `..`; scenes are read from the server's scene directory and images written
+// under its output directory. Image size, spp and depth are capped, and
+// so are the server's totals: a fixed pool of connection handlers, each given request_seconds to send its line,
+// and at most max_jobs jobs and max_admitted_pixels of framebuffer at once. Past those the reply is `error busy`.
+//
+// The same requests, one per line, can also be run from a job file in-process (run_batch).
+//
+// Built scenes (geometry, BVH and the scene's camera) stay loaded in an LRU cache keyed by the reference and the
+// file's size and modification time, so a repeat job against a hot scene only waits for a free thread.
+// All jobs share one pool of render threads and are interleaved tile by tile with weighted fair sharing: the job
+// that has received the least work for its priority gets the next tile.
+
+struct server_scene {
+    shared_ptr<hittable> world;
+    camera view;    // the scene's own camera settings, which requests override
+};
+
+class scene_cache {
+public:
+    typedef std::function<shared_ptr<server_scene>(const std::string& reference)> loader;
+
+    scene_cache(size_t capacity, loader load) : capacity(capacity > 0 ? capacity : 1), load(load) {}
+
+    shared_ptr<server_scene> get(const std::string& reference, bool& hit) {
+        // Loads on a miss, on the calling thread; other requests for the same scene wait for that load instead of
+        // starting their own. Returns null if the scene can't be loaded.
+        std::string key = reference + '\n' + file_identity(reference);
+        std::unique_lock<std::mutex> guard(lock);
+        auto found = entries.find(key);
+        hit = found != entries.end();
+        if (hit) {
+            loaded.wait(guard, [&] {
+                auto e = entries.find(key);
+                return e == entries.end() || !e->second.loading;
+            });
+            found = entries.find(key);      // a failed load removes its entry
+            if (found != entries.end()) {
+                order.splice(order.begin(), order, found->second.position);
+                return found->second.scene;
+            }
+            hit = false;
+        }
+
+        auto& entry = entries[key];
+        entry.loading = true;
+        order.push_front(key);
+        entry.position = order.begin();
+        guard.unlock();
+
+        std::clog << "Loading scene " << reference << ".\n";
+        auto scene = load(reference);
+
+        guard.lock();
+        auto& done = entries[key];
+        done.loading = false;
+        if (scene) {
+            done.scene = scene;
+        } else {
+            order.erase(done.position);
+            entries.erase(key);
+        }
+        while (entries.size() > capacity) {
+            // Least recently used first. Jobs still rendering it keep their shared_ptr.
+            auto oldest = entries.find(order.back());
+            if (oldest->second.loading)
+                break;
+            std::clog << "Dropping scene " << order.back().substr(0, order.back().find('\n')) << " from the cache.\n";
+            entries.erase(oldest);
+            order.pop_back();
+        }
+        loaded.notify_all();
+        return scene;
+    }
+
+private:
+    struct entry {
+        shared_ptr<server_scene> scene;
+        bool loading = false;
+        std::list<std::string>::iterator position;
+    };
+
+    size_t capacity;
+    loader load;
+    std::mutex lock;
+    std::condition_variable loaded;
+    std::map<std::string, entry> entries;
+    std::list<std::string> order;       // most recently used first
+
+    static std::string file_identity(const std::string& reference) {
+        // An edited scene file is a different scene.
+        struct stat info;
+        if (stat(reference.c_str(), &info) != 0)
+            return std::string();
+        return std::to_string(static_cast<long long>(info.st_size)) + ' '
+             + std::to_string(static_cast<long long>(info.st_mtim.tv_sec)) + '.'
+             + std::to_string(static_cast<long long>(info.st_mtim.tv_nsec));
+    }
+};
+
+class render_server {
+public:
+    render_server(int threads, size_t cache_scenes, scene_cache::loader load)
+      : scenes(cache_scenes, load), writer(std::make_shared<image_writer>(threads)) {
+        for (int k = 0; k < (threads > 0 ? threads : 1); ++k)
+            pool.emplace_back([this] { work(); });
+    }
+
+    render_server(const render_server&) = delete;
+    render_server& operator=(const render_server&) = delete;
+
+    ~render_server() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : pool)
+            t.join();
+    }
+
+    static const int max_width = 16384;
+    static const long long max_pixels = 1LL << 24;     // about 670 MB of framebuffer
+    static const int max_samples = 1 << 16;
+    static const int max_bounces = 1024;
+
+    static const int max_jobs = 16;                                 // admitted and not yet finished
+    static const long long max_admitted_pixels = 2 * max_pixels;    // their framebuffers together
+    static const int handlers = 32;                 // connections being read or waiting for their job
+    static const int max_waiting_clients = 64;      // accepted connections waiting for a handler
+    static const int request_seconds = 10;          // to send the request line, and for each reply send
+
+    bool serve(const std::string& address, const std::string& output_dir, const std::string& scene_dir) {
+        // Accepts clients until the process is stopped and hands them to a fixed pool of handler threads, each
+        // of which reads one request and holds the connection until its job is done. Requests read scenes from
+        // scene_dir and write their images under output_dir only.
+        output_root = output_dir.empty() ? "." : output_dir;
+        scene_root = scene_dir.empty() ? "." : scene_dir;
+        int listener = farm_detail::open_socket(address, true);
+        if (listener < 0) {
+            std::clog << "Cannot listen on " << address << ".\n";
+            return false;
+        }
+        std::clog << "Serving renders on " << address << " with " << pool.size() << " threads.\n";
+        for (int k = 0; k < handlers; ++k)
+            std::thread([this] { handle_clients(); }).detach();
+        for (;;) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0)
+                continue;
+            timeval timeout = {request_seconds, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            std::unique_lock<std::mutex> guard(clients_lock);
+            if (clients.size() >= static_cast<size_t>(max_waiting_clients)) {
+                guard.unlock();
+                const char busy[] = "error busy\n";
+                send(client, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+                close(client);
+                continue;
+            }
+            clients.push_back(client);
+            client_ready.notify_one();
+        }
+    }
+
+    bool run_batch(const std::string& path, std::ostream& report) {
+        // A job file: one request line per image, as sent to the server. Lines starting with `defaults` set fields
+        // for the lines after them; blank lines and lines starting with # are skipped.
+        // Every job uses the scene cache, so a scene is built once for the whole batch. Two jobs are kept in the
+        // queue at a time: the threads move on to the next image while the last tiles of one finish and its PNG
+        // is encoded, and only a couple of framebuffers are alive at once.
+        std::ifstream file(path);
+        if (!file) {
+            std::clog << "Cannot open job file " << path << ".\n";
+            return false;
+        }
+        auto begin = clock::now();
+        std::map<std::string, std::string> defaults;
+        std::deque<shared_ptr<job>> running;
+        bool all_ok = true;
+        int line_number = 0, jobs = 0;
+        for (std::string line; std::getline(file, line); ) {
+            line_number++;
+            auto first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+            std::string error;
+            if (line.compare(first, 8, "defaults") == 0) {
+                if (parse_fields(line.substr(first + 8), defaults, error))
+                    continue;
+            } else {
+                if (running.size() >= 2) {
+                    auto reply = finish(running.front());
+                    all_ok = all_ok && reply.compare(0, 5, "done ") == 0;
+                    report << reply << std::endl;
+                    running.pop_front();
+                }
+                auto j = start(line, defaults, error);
+                if (j) {
+                    running.push_back(j);
+                    jobs++;
+                    continue;
+                }
+            }
+            report << "error " << path << ':' << line_number << ": " << error << std::endl;
+            all_ok = false;
+        }
+        for (auto& j : running) {
+            auto reply = finish(j);
+            all_ok = all_ok && reply.compare(0, 5, "done ") == 0;
+            report << reply << std::endl;
+        }
+        std::clog << jobs << " images in " << std::chrono::duration<double>(clock::now() - begin).count() << " s.\n";
+        return all_ok;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct job {
+        camera cam;
+        shared_ptr<server_scene> scene;
+        framebuffer image;
+        std::mutex image_lock;
+        std::vector<image_tile> tiles;
+        size_t next = 0;                // tiles handed out
+        size_t traced = 0;              // tiles committed
+        double priority = 1;
+        double served = 0;              // work received (pixel samples) divided by priority
+        clock::time_point received, first_tile;
+        long long pixels = 0;           // counted in admitted_pixels until finish()
+        bool scene_hit = false;
+        bool finished = false, ok = false;
+    };
+
+    scene_cache scenes;
+    std::string output_root;            // set by serve(); empty (batch jobs from a local file) = paths as given
+    std::string scene_root;
+    shared_ptr<image_writer> writer;
+    std::vector<std::thread> pool;
+    std::mutex lock;
+    std::condition_variable wake, finished;
+    std::list<shared_ptr<job>> queued;  // jobs with tiles not yet handed out
+    int admitted_jobs = 0;              // started and not yet finished, under lock
+    long long admitted_pixels = 0;
+    bool stopping = false;
+
+    std::mutex clients_lock;            // accepted connections waiting for a handler (serve)
+    std::condition_variable client_ready;
+    std::deque<int> clients;
+
+    void work() {
+        for (;;) {
+            shared_ptr<job> j;
+            image_tile tile;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] { return stopping || !queued.empty(); });
+                if (stopping)
+                    return;
+                auto pick = queued.begin();
+                for (auto it = queued.begin(); it != queued.end(); ++it)
+                    if ((*it)->served < (*pick)->served)
+                        pick = it;
+                j = *pick;
+                tile = j->tiles[j->next++];
+                if (j->next == 1)
+                    j->first_tile = clock::now();
+                j->served += double(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * j->cam.samples_per_pixel / j->priority;
+                if (j->next == j->tiles.size())
+                    queued.erase(pick);
+            }
+
+            j->cam.render_tile(*j->scene->world, j->image, tile, j->image_lock);
+
+            bool last;
+            {
+                std::lock_guard<std::mutex> guard(j->image_lock);
+                last = ++j->traced == j->tiles.size();
+            }
+            if (last) {
+                j->cam.save_image(j->image, [this, j](bool ok) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    j->finished = true;
+                    j->ok = ok;
+                    finished.notify_all();
+                });
+            }
+        }
+    }
+
+    void submit(const shared_ptr<job>& j) {
+        // A new job starts level with the least served job in the queue: it neither waits for the others'
+        // history to catch up nor gets to monopolize the threads.
+        std::lock_guard<std::mutex> guard(lock);
+        if (!queued.empty()) {
+            j->served = queued.front()->served;
+            for (const auto& other : queued)
+                j->served = std::min(j->served, other->served);
+        }
+        queued.push_back(j);
+        wake.notify_all();
+    }
+
+    void handle_clients() {
+        for (;;) {
+            int client;
+            {
+                std::unique_lock<std::mutex> guard(clients_lock);
+                client_ready.wait(guard, [this] { return !clients.empty(); });
+                client = clients.front();
+                clients.pop_front();
+            }
+            handle(client);
+        }
+    }
+
+    void handle(int client) {
+        // SO_RCVTIMEO bounds each recv; the deadline bounds the whole line, so a client trickling bytes
+        // can't hold the handler either.
+        auto deadline = clock::now() + std::chrono::seconds(request_seconds);
+        std::string request;
+        char c;
+        bool complete = false;
+        while (request.size() < 4096 && clock::now() < deadline && recv(client, &c, 1, 0) == 1) {
+            if (c == '\n') {
+                complete = true;
+                break;
+            }
+            request += c;
+        }
+        if (!complete) {
+            const char timeout[] = "error no request line\n";
+            farm_detail::send_all(client, timeout, sizeof(timeout) - 1);
+            close(client);
+            return;
+        }
+
+        std::string reply = run(request);
+        reply += '\n';
+        farm_detail::send_all(client, reply.data(), reply.size());
+        close(client);
+    }
+
+    std::string run(const std::string& request) {
+        std::string error;
+        auto j = start(request, std::map<std::string, std::string>(), error);
+        return j ? finish(j) : "error " + error;
+    }
+
+    shared_ptr<job> start(const std::string& request, const std::map<std::string, std::string>& defaults,
+                          std::string& error) {
+        // Parses the request (its fields override `defaults`), gets the scene and queues the job.
+        auto j = std::make_shared<job>();
+        j->received = clock::now();
+
+        auto fields = defaults;
+        if (!parse_fields(request, fields, error))
+            return nullptr;
+        if (fields["scene"].empty() || fields["output"].empty()) {
+            error = "scene= and output= are required";
+            return nullptr;
+        }
+
+        auto reference = fields["scene"];
+        if (!scene_root.empty() && reference != "builtin") {
+            if (!confined(reference)) {
+                error = "scene must be builtin or a relative path without ..";
+                return nullptr;
+            }
+            reference = scene_root + "/" + reference;
+        }
+        j->scene = scenes.get(reference, j->scene_hit);
+        if (!j->scene) {
+            error = "cannot load scene " + fields["scene"];
+            return nullptr;
+        }
+
+        j->cam = j->scene->view;
+        error = apply(fields, output_root, j->cam, j->priority);
+        if (!error.empty())
+            return nullptr;
+
+        // Admission: the framebuffer is allocated next and lives until finish().
+        j->pixels = j->cam.image_width * image_height(j->cam);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (admitted_jobs >= max_jobs || admitted_pixels + j->pixels > max_admitted_pixels) {
+                error = "busy";
+                return nullptr;
+            }
+            admitted_jobs++;
+            admitted_pixels += j->pixels;
+        }
+        j->cam.start_image(j->image, writer);
+        j->tiles = j->cam.image_tiles();
+
+        submit(j);
+        return j;
+    }
+
+    std::string finish(const shared_ptr<job>& j) {
+        // Waits until the job's PNG is on disk; the reply line.
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [&] { return j->finished; });
+        admitted_jobs--;
+        admitted_pixels -= j->pixels;
+        if (!j->ok)
+            return "error cannot write " + j->cam.output_path;
+
+        double wait_ms = std::chrono::duration<double, std::milli>(j->first_tile - j->received).count();
+        double seconds = std::chrono::duration<double>(clock::now() - j->received).count();
+        std::ostringstream out;
+        out << "done " << j->cam.output_path << " scene=" << (j->scene_hit ? "hit" : "miss")
+            << " wait_ms=" << wait_ms << " seconds=" << seconds;
+        return out.str();
+    }
+
+    static bool parse_fields(const std::string& line, std::map<std::string, std::string>& fields, std::string& error) {
+        std::istringstream words(line);
+        for (std::string word; words >> word; ) {
+            auto equals = word.find('=');
+            if (equals == std::string::npos) {
+                error = "expected key=value, got " + word;
+                return false;
+            }
+            fields[word.substr(0, equals)] = word.substr(equals + 1);
+        }
+        return true;
+    }
+
+    static bool confined(const std::string& path) {
+        // A relative path that can't climb out of the directory it is resolved in.
+        if (path.empty() || path[0] == '/')
+            return false;
+        std::istringstream parts(path);
+        for (std::string part; std::getline(parts, part, '/'); )
+            if (part == "..")
+                return false;
+        return true;
+    }
+
+    static long long image_height(const camera& cam) {
+        // The height as camera::initialize() will make it.
+        return std::max(1LL, static_cast<long long>(cam.image_width / cam.aspect_ratio));
+    }
+
+    static std::string apply(const std::map<std::string, std::string>& fields, const std::string& output_root,
+                             camera& cam, double& priority) {
+        // Request fields onto the scene's camera; returns what was wrong, if anything.
+        // With an output_root (served requests) output and hdr are confined to it.
+        for (const auto& f : fields) {
+            if ((f.first == "output" || f.first == "hdr") && !output_root.empty()) {
+                if (!confined(f.second))
+                    return f.first + " must be a relative path without ..";
+                (f.first == "output" ? cam.output_path : cam.hdr_path) = output_root + "/" + f.second;
+                continue;
+            }
+            const std::string& key = f.first;
+            const char* value = f.second.c_str();
+            double v[3];
+            bool triple = std::sscanf(value, "%lf,%lf,%lf", &v[0], &v[1], &v[2]) == 3;
+            if (key == "scene")
+                continue;
+            else if (key == "output")
+                cam.output_path = f.second;
+            else if (key == "hdr")
+                cam.hdr_path = f.second;
+            else if (key == "spp")
+                cam.samples_per_pixel = std::atoi(value);
+            else if (key == "width")
+                cam.image_width = std::atoi(value);
+            else if (key == "max_depth")
+                cam.max_depth = std::atoi(value);
+            else if (key == "vfov")
+                cam.vfov = std::atof(value);
+            else if (key == "defocus_angle")
+                cam.defocus_angle = std::atof(value);
+            else if (key == "focus_dist")
+                cam.focus_dist = std::atof(value);
+            else if (key == "priority")
+                priority = std::atof(value);
+            else if ((key == "lookfrom" || key == "lookat" || key == "vup") && triple)
+                (key == "lookfrom" ? cam.lookfrom : key == "lookat" ? cam.lookat : cam.vup) = vec3(v[0], v[1], v[2]);
+            else
+                return "bad field " + key + "=" + f.second;
+        }
+        if (cam.samples_per_pixel < 1 || cam.image_width < 1 || cam.max_depth < 1 || !(priority > 0))
+            return "spp, width, max_depth and priority must be positive";
+        // Within [0.1, 10], so no job can take every tile from the others (or be starved by them).
+        priority = std::min(std::max(priority, 0.1), 10.0);
+        if (cam.image_width > max_width || cam.image_width * image_height(cam) > max_pixels)
+            return "image too large: at most " + std::to_string(max_width) + " wide and "
+                 + std::to_string(max_pixels) + " pixels";
+        if (cam.samples_per_pixel > max_samples || cam.max_depth > max_bounces)
+            return "spp is limited to " + std::to_string(max_samples) + " and max_depth to " + std::to_string(max_bounces);
+        return std::string();
+    }
+};
+
+inline bool submit_render(const std::string& address, const std::string& request, std::string& reply) {
+    // Client side: sends one request line and waits for the reply line.
+    int fd = farm_detail::open_socket(address, false);
+    if (fd < 0) {
+        std::clog << "Cannot reach render server at " << address << ".\n";
+        return false;
+    }
+    std::string line = request + '\n';
+    bool sent = farm_detail::send_all(fd, line.data(), line.size());
+    reply.clear();
+    char c;
+    while (sent && recv(fd, &c, 1, 0) == 1 && c != '\n')
+        reply += c;
+    close(fd);
+    return sent && reply.compare(0, 5, "done ") == 0;
+}
+
+#endif /* RENDER_SERVER_H */
+
+// Note
+// 매 job마다 result를 새로 실행하면 scene과 bvh_node를 다시 만드는 cold start가 생김.
+// server는 만든 scene을 LRU cache에 두고, 모든 job이 하나의 thread pool을 tile 단위로 나눠 씀.
+// Weighted fair share: a job with priority 2 gets about twice the tiles per second of a priority 1 job while both are queued.
@@ -9,6 +9,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -26,9 +27,26 @@ const double pi = 3.1415926535897932385;
 inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
+inline uint64_t mix_bits(uint64_t x) {
+    // SplitMix64 finalizer: spreads every input bit over the whole word. Turns (row, sample index) into seeds.
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+inline uint64_t& random_state() {
+    // Per-thread generator state. Unlike rand() it can be saved and reseeded, so a sample's random numbers
+    // depend only on where the renderer seeded them and not on everything drawn before.
+    static thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+inline void seed_random(uint64_t seed) {
+    random_state() = seed;
+}
 inline double random_double() {
-    // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1). SplitMix64: one add and the finalizer per number, top 53 bits used.
+    uint64_t& state = random_state();
+    state += 0x9e3779b97f4a7c15ULL;
+    return static_cast<double>(mix_bits(state) >> 11) * (1.0 / 9007199254740992.0);
 }
 inline double random_double(double min, double max) {
     // Returns a random real in [min,max).
@@ -0,0 +1,729 @@
+//
+//  scene_file.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "color.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+#include "sphere_set.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary scene format (.rtscene)
+// Every record is plain old data with a fixed size, and every section starts on a 64-byte boundary,
+// so a mapped file can be used in place: spheres, materials and BVH nodes are read straight out of the mapping.
+//
+//   scene_file_header
+//   scene_camera_record
+//   scene_material_record[material_count]
+//   scene_sphere_record[sphere_count]      (in BVH leaf order when a BVH is present)
+//   scene_bvh_record[node_count]           (optional, node 0 is the root)
+
+const uint32_t scene_file_version = 1;
+const char scene_file_magic[8] = {'R','T','S','C','E','N','E','\0'};
+
+enum scene_material_type : uint32_t {
+    scene_material_lambertian = 0,
+    scene_material_metal      = 1,
+    scene_material_dielectric = 2,
+};
+
+struct scene_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;       // sizeof(scene_file_header), guards against layout drift
+    uint64_t file_size;
+    uint64_t camera_offset;
+    uint64_t material_offset, material_count;
+    uint64_t sphere_offset, sphere_count;
+    uint64_t node_offset, node_count;    // node_count == 0 means no prebuilt BVH
+};
+
+struct scene_camera_record {
+    double  aspect_ratio;
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t reserved;
+    double  vfov;
+    double  lookfrom[3];
+    double  lookat[3];
+    double  vup[3];
+    double  defocus_angle;
+    double  focus_dist;
+};
+
+struct scene_material_record {
+    uint32_t type;      // scene_material_type
+    float    albedo[3];
+    float    param;     // fuzz for metal, index of refraction for dielectric
+};
+
+struct scene_sphere_record {
+    float    center[3];
+    float    radius;
+    float    motion[3];  // center2 - center1, all zero for a stationary sphere
+    uint32_t material;
+};
+
+struct scene_bvh_record {
+    float    bmin[3];
+    uint32_t offset;     // leaf: first sphere, inner: index of the right child (the left child is the next node)
+    float    bmax[3];
+    uint16_t count;      // leaf: sphere count, inner: 0
+    uint16_t axis;       // inner: split axis, used to visit the nearer child first
+};
+
+static_assert(sizeof(scene_camera_record) == 120, "scene_camera_record layout changed");
+static_assert(sizeof(scene_material_record) == 20, "scene_material_record layout changed");
+static_assert(sizeof(scene_sphere_record) == 32, "scene_sphere_record layout changed");
+static_assert(sizeof(scene_bvh_record) == 32, "scene_bvh_record layout changed");
+
+
+// Conservative double -> float conversions for bounds, so a float box never shrinks below the double geometry.
+inline float float_round_down(double x) {
+    float f = static_cast<float>(x);
+    return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float float_round_up(double x) {
+    float f = static_cast<float>(x);
+    return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+inline aabb sphere_record_box(const scene_sphere_record& s) {
+    auto c1 = point3(s.center[0], s.center[1], s.center[2]);
+    auto c2 = c1 + vec3(s.motion[0], s.motion[1], s.motion[2]);
+    auto rvec = vec3(s.radius, s.radius, s.radius);
+    return aabb(aabb(c1 - rvec, c1 + rvec), aabb(c2 - rvec, c2 + rvec));
+}
+
+inline bool hit_sphere_record(const scene_sphere_record& s, const ray& r, interval ray_t, hit_record& rec) {
+    // Same math as sphere::hit, done in double on the float record.
+    point3 center(s.center[0], s.center[1], s.center[2]);
+    center += r.time() * vec3(s.motion[0], s.motion[1], s.motion[2]);
+    double radius = s.radius;
+
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = half_b*half_b - a*c;
+    if (discriminant < 0)   return false;
+    auto sqrtd = sqrt(discriminant);
+
+    auto root = (-half_b - sqrtd) / a;
+    if (!ray_t.surrounds(root)) {
+        root = (-half_b + sqrtd) / a;
+        if (!ray_t.surrounds(root))
+            return false;
+    }
+
+    rec.t = root;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    return true;
+}
+
+
+class material_table {
+public:
+    // Materials can't live in the mapping (they carry a vtable), so they are materialized once per scene,
+    // one contiguous array per material kind: three allocations in total, independent of the material count.
+    void build(const scene_material_record* records, size_t count) {
+        size_t counts[3] = {0, 0, 0};
+        for (size_t i = 0; i < count; i++)
+            counts[records[i].type < 3 ? records[i].type : 0]++;
+
+        lambertians.clear();
+        metals.clear();
+        dielectrics.clear();
+        lambertians.reserve(counts[scene_material_lambertian] + 1);
+        metals.reserve(counts[scene_material_metal]);
+        dielectrics.reserve(counts[scene_material_dielectric]);
+
+        lookup.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const auto& m = records[i];
+            auto albedo = color(m.albedo[0], m.albedo[1], m.albedo[2]);
+            switch (m.type) {
+                case scene_material_metal:
+                    metals.emplace_back(albedo, m.param);
+                    lookup[i] = &metals.back();
+                    break;
+                case scene_material_dielectric:
+                    dielectrics.emplace_back(m.param);
+                    lookup[i] = &dielectrics.back();
+                    break;
+                default:
+                    lambertians.emplace_back(albedo);
+                    lookup[i] = &lambertians.back();
+                    break;
+            }
+        }
+
+        // Out-of-range indices in a damaged file shade as mid grey instead of reading past the table.
+        lambertians.emplace_back(color(0.5, 0.5, 0.5));
+        fallback = &lambertians.back();
+    }
+
+    const material* get(uint32_t index) const {
+        return index < lookup.size() ? lookup[index] : fallback;
+    }
+
+private:
+    std::vector<lambertian> lambertians;
+    std::vector<metal> metals;
+    std::vector<dielectric> dielectrics;
+    std::vector<const material*> lookup;
+    const material* fallback = nullptr;
+};
+
+
+// In-memory sphere and material: the record fields in double. Scenes generated in code keep their exact values;
+// they are rounded to float only when written to a file (scene_data::sphere_records and material_records).
+struct scene_material {
+    scene_material_type type;
+    color  albedo;
+    double param;
+};
+
+struct scene_sphere {
+    point3   center;
+    double   radius;
+    vec3     motion;
+    uint32_t material;
+};
+
+inline scene_sphere_record sphere_record(const scene_sphere& s) {
+    scene_sphere_record r;
+    for (int a = 0; a < 3; a++) {
+        r.center[a] = static_cast<float>(s.center[a]);
+        r.motion[a] = static_cast<float>(s.motion[a]);
+    }
+    r.radius = static_cast<float>(s.radius);
+    r.material = s.material;
+    return r;
+}
+
+inline scene_sphere in_memory_sphere(const scene_sphere_record& r) {
+    return scene_sphere{point3(r.center[0], r.center[1], r.center[2]), r.radius,
+                        vec3(r.motion[0], r.motion[1], r.motion[2]), r.material};
+}
+
+inline scene_material_record material_record(const scene_material& m) {
+    scene_material_record r;
+    r.type = m.type;
+    for (int a = 0; a < 3; a++)
+        r.albedo[a] = static_cast<float>(m.albedo[a]);
+    r.param = static_cast<float>(m.param);
+    return r;
+}
+
+
+class scene_data {
+public:
+    // In-memory form of a scene, used to generate scenes in code and to write .rtscene files.
+    scene_camera_record camera;
+    std::vector<scene_material> materials;
+    std::vector<scene_sphere> spheres;
+    std::vector<scene_bvh_record> nodes;    // bounds cover the spheres as written (sphere_records)
+
+    scene_data() {
+        std::memset(&camera, 0, sizeof(camera));
+        camera.aspect_ratio = 1.0;
+        camera.image_width = 100;
+        camera.samples_per_pixel = 10;
+        camera.max_depth = 10;
+        camera.vfov = 90;
+        camera.lookfrom[2] = -1;
+        camera.vup[1] = 1;
+        camera.focus_dist = 10;
+    }
+
+    uint32_t add_material(scene_material_type type, const color& albedo, double param = 0) {
+        materials.push_back(scene_material{type, albedo, param});
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    void add_sphere(const point3& center, double radius, uint32_t material) {
+        add_sphere(center, center, radius, material);
+    }
+
+    void add_sphere(const point3& center1, const point3& center2, double radius, uint32_t material) {
+        spheres.push_back(scene_sphere{center1, radius, center2 - center1, material});
+        nodes.clear();  // any prebuilt BVH is stale now
+    }
+
+    hittable_list build_world(scene_arena* objects = nullptr) const {
+        // Regular shared_ptr scene for the bvh_node path: one sphere object per record, materials shared by index.
+        // With a scene_arena, spheres and materials are placed in it instead of on the heap, and the list only borrows them.
+        hittable_list world;
+        auto objects_list = build_spheres(objects);
+        world.objects.assign(objects_list.begin(), objects_list.end());
+        return world;
+    }
+
+    std::vector<shared_ptr<sphere>> build_spheres(scene_arena* objects = nullptr) const {
+        // The same objects as build_world, typed as spheres for object_set<sphere>.
+        std::vector<shared_ptr<material>> mats;
+        mats.reserve(materials.size() + 1);
+        for (const auto& m : materials) {
+            if (m.type == scene_material_metal)
+                mats.push_back(make<metal>(objects, m.albedo, m.param));
+            else if (m.type == scene_material_dielectric)
+                mats.push_back(make<dielectric>(objects, m.param));
+            else
+                mats.push_back(make<lambertian>(objects, m.albedo));
+        }
+        auto fallback = make<lambertian>(objects, color(0.5, 0.5, 0.5));
+
+        std::vector<shared_ptr<sphere>> result;
+        result.reserve(spheres.size());
+        for (const auto& s : spheres) {
+            auto mat = s.material < mats.size() ? mats[s.material] : fallback;
+            if (s.motion[0] == 0 && s.motion[1] == 0 && s.motion[2] == 0)
+                result.push_back(make_sphere(objects, s.center, s.radius, mat));
+            else
+                result.push_back(make_sphere(objects, s.center, s.center + s.motion, s.radius, mat));
+        }
+        return result;
+    }
+
+    sphere_set build_sphere_set() const {
+        // Packed form for compressed_bvh<sphere_set>: 16 bytes per stationary sphere plus a material index.
+        sphere_set set;
+        for (const auto& m : materials) {
+            if (m.type == scene_material_metal)
+                set.add_material(make_shared<metal>(m.albedo, m.param));
+            else if (m.type == scene_material_dielectric)
+                set.add_material(make_shared<dielectric>(m.param));
+            else
+                set.add_material(make_shared<lambertian>(m.albedo));
+        }
+        auto fallback = set.add_material(make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+
+        for (const auto& s : spheres) {
+            auto mat = s.material < materials.size() ? s.material : fallback;
+            set.add(s.center, s.center + s.motion, s.radius, mat);
+        }
+        set.shrink_to_fit();
+        return set;
+    }
+
+    bool has_motion() const {
+        for (const auto& s : spheres)
+            if (s.motion[0] != 0 || s.motion[1] != 0 || s.motion[2] != 0)
+                return true;
+        return false;
+    }
+
+    std::vector<scene_sphere_record> sphere_records() const {
+        std::vector<scene_sphere_record> records;
+        records.reserve(spheres.size());
+        for (const auto& s : spheres)
+            records.push_back(sphere_record(s));
+        return records;
+    }
+
+    std::vector<scene_material_record> material_records() const {
+        std::vector<scene_material_record> records;
+        records.reserve(materials.size());
+        for (const auto& m : materials)
+            records.push_back(material_record(m));
+        return records;
+    }
+
+    void build_bvh(int leaf_size = 4) {
+        // Flat BVH in depth-first order. Spheres are reordered so each leaf covers a contiguous range,
+        // which is what lets the mapped file skip a separate primitive index array.
+        nodes.clear();
+        if (spheres.empty())
+            return;
+        nodes.reserve(2 * spheres.size() / leaf_size + 1);
+        build_range(0, spheres.size(), leaf_size > 0 ? leaf_size : 1);
+    }
+
+    bool write(const std::string& path) const {
+        scene_file_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, scene_file_magic, sizeof(header.magic));
+        header.version = scene_file_version;
+        header.header_size = sizeof(scene_file_header);
+
+        uint64_t offset = align(sizeof(scene_file_header));
+        header.camera_offset = offset;
+        offset = align(offset + sizeof(scene_camera_record));
+        header.material_offset = offset;
+        header.material_count = materials.size();
+        offset = align(offset + materials.size() * sizeof(scene_material_record));
+        header.sphere_offset = offset;
+        header.sphere_count = spheres.size();
+        offset = align(offset + spheres.size() * sizeof(scene_sphere_record));
+        header.node_offset = offset;
+        header.node_count = nodes.size();
+        offset += nodes.size() * sizeof(scene_bvh_record);
+        header.file_size = offset;
+
+        // Write to a temporary name and rename, so readers never map a half-written file.
+        std::string tmp_path = path + ".tmp";
+        FILE* f = std::fopen(tmp_path.c_str(), "wb");
+        if (!f) {
+            std::clog << "Cannot open " << tmp_path << " for writing.\n";
+            return false;
+        }
+
+        auto material_section = material_records();
+        auto sphere_section = sphere_records();
+        bool ok = write_at(f, 0, &header, sizeof(header))
+               && write_at(f, header.camera_offset, &camera, sizeof(camera))
+               && write_at(f, header.material_offset, material_section.data(), materials.size() * sizeof(scene_material_record))
+               && write_at(f, header.sphere_offset, sphere_section.data(), spheres.size() * sizeof(scene_sphere_record))
+               && write_at(f, header.node_offset, nodes.data(), nodes.size() * sizeof(scene_bvh_record));
+        ok = (std::fclose(f) == 0) && ok;
+
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::clog << "Failed to write scene file " << path << ".\n";
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    template <typename T, typename... Args>
+    static shared_ptr<material> make(scene_arena* objects, Args&&... args) {
+        if (objects)
+            return objects->make_material<T>(std::forward<Args>(args)...);
+        return make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    static shared_ptr<sphere> make_sphere(scene_arena* objects, Args&&... args) {
+        if (objects)
+            return objects->make_primitive<sphere>(std::forward<Args>(args)...);
+        return make_shared<sphere>(std::forward<Args>(args)...);
+    }
+
+    static uint64_t align(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+    static bool write_at(FILE* f, uint64_t offset, const void* data, size_t size) {
+        if (size == 0)
+            return true;
+        if (std::fseek(f, static_cast<long>(offset), SEEK_SET) != 0)
+            return false;
+        return std::fwrite(data, 1, size, f) == size;
+    }
+
+    static double centroid(const scene_sphere& s, int axis) {
+        return s.center[axis] + 0.5 * s.motion[axis];
+    }
+
+    uint32_t build_range(size_t start, size_t end, int leaf_size) {
+        auto index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(scene_bvh_record());
+
+        aabb box, centroid_box;
+        for (size_t i = start; i < end; i++) {
+            box = aabb(box, sphere_record_box(sphere_record(spheres[i])));   // the float sphere the file will hold
+            auto c = point3(centroid(spheres[i], 0), centroid(spheres[i], 1), centroid(spheres[i], 2));
+            centroid_box = aabb(centroid_box, aabb(c, c));
+        }
+
+        scene_bvh_record node;
+        for (int a = 0; a < 3; a++) {
+            node.bmin[a] = float_round_down(box.axis(a).min);
+            node.bmax[a] = float_round_up(box.axis(a).max);
+        }
+
+        size_t span = end - start;
+        if (span <= static_cast<size_t>(leaf_size)) {
+            node.offset = static_cast<uint32_t>(start);
+            node.count = static_cast<uint16_t>(span);
+            node.axis = 0;
+            nodes[index] = node;
+            return index;
+        }
+
+        int axis = 0;
+        if (centroid_box.y.size() > centroid_box.axis(axis).size()) axis = 1;
+        if (centroid_box.z.size() > centroid_box.axis(axis).size()) axis = 2;
+
+        auto mid = start + span/2;
+        std::nth_element(spheres.begin() + start, spheres.begin() + mid, spheres.begin() + end,
+            [axis](const scene_sphere& a, const scene_sphere& b) {
+                return centroid(a, axis) < centroid(b, axis);
+            });
+
+        build_range(start, mid, leaf_size);
+        node.offset = build_range(mid, end, leaf_size);
+        node.count = 0;
+        node.axis = static_cast<uint16_t>(axis);
+        nodes[index] = node;
+        return index;
+    }
+};
+
+
+class flat_scene final : public hittable {
+public:
+    // Renders straight from the record arrays of a mapped .rtscene file (or, for a file without a BVH, a copy
+    // of its spheres in leaf order).
+    // Nothing here allocates per primitive; spheres and nodes are only read.
+
+    flat_scene() {}
+    flat_scene(const flat_scene&) = delete;
+    flat_scene& operator=(const flat_scene&) = delete;
+
+    ~flat_scene() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::clog << "Cannot open scene file " << path << ".\n";
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(scene_file_header)) {
+            std::clog << "Scene file " << path << " is too small.\n";
+            ::close(fd);
+            return false;
+        }
+
+        mapping_size = static_cast<size_t>(st.st_size);
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            std::clog << "Cannot map scene file " << path << ".\n";
+            return false;
+        }
+        // Traversal jumps around the file, so readahead would mostly fetch pages no ray needs.
+        madvise(mapping, mapping_size, MADV_RANDOM);
+
+        const auto* base = static_cast<const unsigned char*>(mapping);
+        const auto* header = reinterpret_cast<const scene_file_header*>(base);
+        if (!valid_header(*header)) {
+            std::clog << "Scene file " << path << " is not a version " << scene_file_version << " .rtscene file.\n";
+            close();
+            return false;
+        }
+
+        cam = reinterpret_cast<const scene_camera_record*>(base + header->camera_offset);
+        spheres = reinterpret_cast<const scene_sphere_record*>(base + header->sphere_offset);
+        sphere_count = header->sphere_count;
+        nodes = reinterpret_cast<const scene_bvh_record*>(base + header->node_offset);
+        node_count = header->node_count;
+        materials.build(reinterpret_cast<const scene_material_record*>(base + header->material_offset),
+                        header->material_count);
+        if (!valid_tree()) {
+            std::clog << "Scene file " << path << " has a damaged BVH.\n";
+            close();
+            return false;
+        }
+
+        if (node_count == 0 && sphere_count > 0) {
+            // No prebuilt BVH: fall back to building one in memory, which needs a writable copy of the spheres.
+            std::clog << "Scene file " << path << " has no BVH, building one.\n";
+            scene_data owned;
+            for (size_t i = 0; i < sphere_count; i++)
+                owned.spheres.push_back(in_memory_sphere(spheres[i]));
+            owned.build_bvh();
+            owned_spheres = owned.sphere_records();     // the same floats, in leaf order
+            owned_nodes.swap(owned.nodes);
+            spheres = owned_spheres.data();
+            nodes = owned_nodes.data();
+            node_count = owned_nodes.size();
+        }
+
+        compute_bbox();
+        return true;
+    }
+
+    void close() {
+        if (mapping)
+            munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+        cam = nullptr;
+        spheres = nullptr;
+        nodes = nullptr;
+        sphere_count = node_count = 0;
+        owned_spheres.clear();
+        owned_nodes.clear();
+        bbox = aabb();
+    }
+
+    const scene_camera_record& camera_settings() const { return *cam; }
+    size_t size() const { return sphere_count; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (node_count == 0)
+            return false;
+
+        const double orig[3] = { r.origin().x(), r.origin().y(), r.origin().z() };
+        const double inv_dir[3] = { 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() };
+
+        // valid_tree() has checked every index this reads, and that the tree is shallow enough for the stack:
+        // depth-first, the stack never holds more than one node per level plus the one being visited.
+        uint32_t stack[max_stack];
+        int top = 0;
+        stack[top++] = 0;
+
+        const scene_sphere_record* closest = nullptr;
+        while (top > 0) {
+            const auto& node = nodes[stack[--top]];
+            if (!hit_box(node, orig, inv_dir, ray_t))
+                continue;
+
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    if (hit_sphere_record(spheres[i], r, ray_t, rec)) {
+                        ray_t.max = rec.t;
+                        closest = &spheres[i];
+                    }
+                }
+            } else {
+                // Push the farther child first so the nearer one is popped next and shrinks ray_t early.
+                uint32_t left = static_cast<uint32_t>(&node - nodes) + 1;
+                uint32_t right = node.offset;
+                if (inv_dir[node.axis] < 0) {
+                    stack[top++] = left;
+                    stack[top++] = right;
+                } else {
+                    stack[top++] = right;
+                    stack[top++] = left;
+                }
+            }
+        }
+
+        if (!closest)
+            return false;
+        rec.mat = materials.get(closest->material);
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    const scene_camera_record* cam = nullptr;
+    const scene_sphere_record* spheres = nullptr;
+    const scene_bvh_record* nodes = nullptr;
+    size_t sphere_count = 0;
+    size_t node_count = 0;
+
+    material_table materials;
+    std::vector<scene_sphere_record> owned_spheres;     // only used when the file has no prebuilt BVH
+    std::vector<scene_bvh_record> owned_nodes;
+    aabb bbox;
+
+    static const int max_stack = 64;
+    static const int max_tree_depth = max_stack - 2;
+
+    bool valid_tree() const {
+        // Walks the whole BVH once before any ray does: every leaf's sphere range inside the sphere section, every
+        // child after its parent (depth-first order, so there are no cycles) and inside the node section, no node
+        // reached twice, a split axis of 0-2, and no path deeper than the traversal stack allows.
+        // scene_data::build_bvh trees are balanced (median splits), so only damaged or crafted files fail this.
+        if (node_count == 0)
+            return true;
+        struct entry { uint64_t node; int depth; };
+        std::vector<entry> pending(1, entry{0, 0});
+        std::vector<bool> reached(node_count, false);
+        while (!pending.empty()) {
+            auto current = pending.back();
+            pending.pop_back();
+            if (current.depth > max_tree_depth || reached[current.node])
+                return false;
+            reached[current.node] = true;
+            const auto& node = nodes[current.node];
+            if (node.count > 0) {
+                if (uint64_t(node.offset) + node.count > sphere_count)
+                    return false;
+                continue;
+            }
+            uint64_t left = current.node + 1, right = node.offset;
+            if (node.axis > 2 || left >= node_count || right <= left || right >= node_count)
+                return false;
+            pending.push_back(entry{left, current.depth + 1});
+            pending.push_back(entry{right, current.depth + 1});
+        }
+        return true;
+    }
+
+    bool valid_header(const scene_file_header& h) const {
+        if (std::memcmp(h.magic, scene_file_magic, sizeof(h.magic)) != 0)  return false;
+        if (h.version != scene_file_version || h.header_size != sizeof(scene_file_header))  return false;
+        if (h.file_size > mapping_size)  return false;
+
+        return section_fits(h.camera_offset, 1, sizeof(scene_camera_record))
+            && section_fits(h.material_offset, h.material_count, sizeof(scene_material_record))
+            && section_fits(h.sphere_offset, h.sphere_count, sizeof(scene_sphere_record))
+            && section_fits(h.node_offset, h.node_count, sizeof(scene_bvh_record));
+    }
+
+    bool section_fits(uint64_t offset, uint64_t count, uint64_t record_size) const {
+        if (offset % 8 != 0 || offset > mapping_size)
+            return false;
+        return count <= (mapping_size - offset) / record_size;
+    }
+
+    void compute_bbox() {
+        bbox = aabb();
+        if (node_count > 0) {
+            const auto& root = nodes[0];
+            bbox = aabb(point3(root.bmin[0], root.bmin[1], root.bmin[2]), point3(root.bmax[0], root.bmax[1], root.bmax[2]));
+        }
+    }
+
+    static bool hit_box(const scene_bvh_record& node, const double* orig, const double* inv_dir, interval ray_t) {
+        for (int a = 0; a < 3; a++) {
+            auto t0 = (node.bmin[a] - orig[a]) * inv_dir[a];
+            auto t1 = (node.bmax[a] - orig[a]) * inv_dir[a];
+            if (inv_dir[a] < 0)
+                std::swap(t0, t1);
+
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif /* SCENE_FILE_H */
+
+// Note
+// .rtscene 파일은 mmap 후 그대로 렌더러가 사용함. 파싱이나 per-object allocation 없이 시작 시간은 page fault에 의해서만 결정됨.
+// Materials are the one exception: they need a vtable, so material_table builds them into three flat arrays when the file is opened.
+// BVH의 leaf는 연속된 sphere range를 가리키므로 별도의 index array가 필요 없음. (writer가 sphere를 leaf 순서로 재배치)
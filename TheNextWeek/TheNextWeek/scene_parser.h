@@ -0,0 +1,412 @@
+//
+//  scene_parser.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef SCENE_PARSER_H
+#define SCENE_PARSER_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "color.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "scene_file.h"
+#include "sphere.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Text scene description, one statement per line ('#' starts a comment):
+//
+//   camera <key> <value...> ...        keys: aspect_ratio image_width samples_per_pixel max_depth vfov
+//                                            lookfrom x y z  lookat x y z  vup x y z  defocus_angle focus_dist
+//   material <name> lambertian r g b
+//   material <name> metal r g b fuzz
+//   material <name> dielectric index_of_refraction
+//   sphere x y z radius <material>
+//   moving_sphere x1 y1 z1 x2 y2 z2 radius <material>
+//
+// camera and material statements form the header and must come before the first sphere.
+// Everything after that is geometry, which is what gets split into chunks and parsed in parallel.
+
+class scene_parser {
+public:
+    size_t chunk_size = size_t(4) << 20;   // Bytes of geometry handed to a worker at a time
+    int    threads    = 0;                 // Parser/builder threads, 0 = hardware concurrency
+
+    bool load(const std::string& path) {
+        // The calling thread reads the file and cuts it into chunks at line boundaries while worker threads
+        // parse earlier chunks and build a bvh_node subtree over each one, so reading, parsing and building overlap.
+        // The chunk subtrees are joined under one top-level bvh_node at the end.
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (!f) {
+            std::clog << "Cannot open scene file " << path << ".\n";
+            return false;
+        }
+
+        reset();
+        int worker_count = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+        if (worker_count < 1)
+            worker_count = 1;
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < worker_count; i++)
+            workers.emplace_back(&scene_parser::work, this);
+
+        read_file(f, path, worker_count);
+        std::fclose(f);
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            reading_done = true;
+        }
+        queue_ready.notify_all();
+        for (auto& w : workers)
+            w.join();
+
+        if (!error.empty()) {
+            std::clog << path << ":" << error << "\n";
+            return false;
+        }
+
+        // Subtrees are kept in file order, so the result doesn't depend on which worker finished first.
+        hittable_list roots;
+        for (auto& subtree : subtrees)
+            if (subtree)
+                roots.add(subtree);
+
+        if (roots.objects.empty())
+            root = make_shared<hittable_list>();
+        else if (roots.objects.size() == 1)
+            root = roots.objects[0];
+        else
+            root = make_shared<bvh_node>(roots);
+        return true;
+    }
+
+    shared_ptr<hittable> world() const { return root; }
+    const scene_camera_record& camera_settings() const { return settings.camera; }
+    size_t primitive_count() const { return primitives; }
+
+private:
+    struct chunk {
+        size_t index;
+        size_t first_line;
+        std::string text;
+    };
+
+    scene_data settings;    // only the camera record is used
+    std::map<std::string, shared_ptr<material>> materials;
+    shared_ptr<hittable> root;
+    size_t primitives = 0;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready, queue_space;
+    std::deque<chunk> queue;
+    size_t max_queued = 1;
+    bool reading_done = false;
+
+    std::mutex result_mutex;
+    std::vector<shared_ptr<hittable>> subtrees;
+    std::string error;  // first error wins, prefixed with its line number
+
+    void reset() {
+        settings = scene_data();
+        materials.clear();
+        root = nullptr;
+        primitives = 0;
+        queue.clear();
+        reading_done = false;
+        subtrees.clear();
+        error.clear();
+    }
+
+    bool failed() {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        return !error.empty();
+    }
+
+    void fail(size_t line, const std::string& message) {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        if (error.empty())
+            error = std::to_string(line) + ": " + message;
+    }
+
+    void read_file(FILE* f, const std::string& path, int worker_count) {
+        max_queued = 2 * static_cast<size_t>(worker_count);
+
+        std::string pending;        // text read but not yet handed out
+        size_t pending_line = 1;    // line number of pending[0]
+        bool in_header = true;
+        size_t chunk_index = 0;
+        std::vector<char> buffer(chunk_size);
+
+        while (!failed()) {
+            size_t got = std::fread(buffer.data(), 1, buffer.size(), f);
+            bool eof = got < buffer.size();
+            pending.append(buffer.data(), got);
+
+            // Header lines are parsed right here, in order, so geometry never sees a half-built material table.
+            size_t pos = 0;
+            while (in_header) {
+                size_t newline = pending.find('\n', pos);
+                if (newline == std::string::npos && !eof)
+                    break;
+                size_t line_end = (newline == std::string::npos) ? pending.size() : newline;
+                if (pos >= pending.size())
+                    break;
+
+                const char* line = pending.c_str() + pos;
+                if (is_geometry(line)) {
+                    in_header = false;
+                    break;
+                }
+                std::string header_line(line, line_end - pos);
+                if (!parse_header(header_line, pending_line))
+                    return;
+                pending_line++;
+                pos = line_end + 1;
+            }
+            pending.erase(0, std::min(pos, pending.size()));
+
+            if (!in_header) {
+                // Hand out everything up to the last complete line; the tail waits for the next read.
+                size_t cut = eof ? pending.size() : pending.rfind('\n');
+                if (cut != std::string::npos && cut > 0) {
+                    chunk c;
+                    c.index = chunk_index++;
+                    c.first_line = pending_line;
+                    c.text.assign(pending, 0, eof ? cut : cut + 1);
+                    pending_line += count_lines(c.text);
+                    pending.erase(0, c.text.size());
+                    push(std::move(c));
+                }
+            }
+
+            if (eof) {
+                if (std::ferror(f))
+                    fail(pending_line, "read error in " + path);
+                break;
+            }
+        }
+    }
+
+    void push(chunk&& c) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_space.wait(lock, [this] { return queue.size() < max_queued; });
+        queue.push_back(std::move(c));
+        lock.unlock();
+        queue_ready.notify_one();
+    }
+
+    void work() {
+        while (true) {
+            chunk c;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_ready.wait(lock, [this] { return !queue.empty() || reading_done; });
+                if (queue.empty())
+                    return;
+                c = std::move(queue.front());
+                queue.pop_front();
+            }
+            queue_space.notify_one();
+
+            if (failed())
+                continue;   // keep draining so the reader never blocks on a full queue
+
+            hittable_list objects;
+            if (!parse_geometry(c, objects))
+                continue;
+
+            shared_ptr<hittable> subtree;
+            if (!objects.objects.empty())
+                subtree = make_shared<bvh_node>(objects.objects, 0, objects.objects.size());
+
+            std::lock_guard<std::mutex> lock(result_mutex);
+            if (subtrees.size() <= c.index)
+                subtrees.resize(c.index + 1);
+            subtrees[c.index] = subtree;
+            primitives += objects.objects.size();
+        }
+    }
+
+    static size_t count_lines(const std::string& text) {
+        size_t n = 0;
+        for (char ch : text)
+            n += (ch == '\n');
+        return n;
+    }
+
+    static const char* skip_space(const char* p) {
+        while (*p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+        return p;
+    }
+
+    static bool is_geometry(const char* line) {
+        line = skip_space(line);
+        return std::strncmp(line, "sphere", 6) == 0 || std::strncmp(line, "moving_sphere", 13) == 0;
+    }
+
+    static bool read_word(const char*& p, std::string& word) {
+        p = skip_space(p);
+        const char* start = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#')
+            p++;
+        word.assign(start, p - start);
+        return !word.empty();
+    }
+
+    static bool read_number(const char*& p, double& value) {
+        p = skip_space(p);
+        if (*p == '\n' || *p == '\0')
+            return false;   // strtod would happily continue on the next line
+        char* end;
+        value = std::strtod(p, &end);
+        if (end == p)
+            return false;
+        p = end;
+        return true;
+    }
+
+    static bool read_numbers(const char*& p, double* values, int count) {
+        for (int i = 0; i < count; i++)
+            if (!read_number(p, values[i]))
+                return false;
+        return true;
+    }
+
+    static bool at_line_end(const char* p) {
+        p = skip_space(p);
+        return *p == '\0' || *p == '\n' || *p == '#';
+    }
+
+    bool parse_header(const std::string& text, size_t line) {
+        const char* p = text.c_str();
+        std::string keyword;
+        if (!read_word(p, keyword))
+            return true;   // blank or comment-only line
+
+        if (keyword == "camera") {
+            auto& cam = settings.camera;
+            std::string key;
+            while (read_word(p, key)) {
+                double v[3];
+                bool ok;
+                if (key == "lookfrom" || key == "lookat" || key == "vup") {
+                    ok = read_numbers(p, v, 3);
+                    double* dst = (key == "lookfrom") ? cam.lookfrom : (key == "lookat") ? cam.lookat : cam.vup;
+                    for (int a = 0; a < 3; a++)
+                        dst[a] = v[a];
+                } else {
+                    ok = read_number(p, v[0]);
+                    if      (key == "aspect_ratio")      cam.aspect_ratio = v[0];
+                    else if (key == "image_width")       cam.image_width = static_cast<int32_t>(v[0]);
+                    else if (key == "samples_per_pixel") cam.samples_per_pixel = static_cast<int32_t>(v[0]);
+                    else if (key == "max_depth")         cam.max_depth = static_cast<int32_t>(v[0]);
+                    else if (key == "vfov")              cam.vfov = v[0];
+                    else if (key == "defocus_angle")     cam.defocus_angle = v[0];
+                    else if (key == "focus_dist")        cam.focus_dist = v[0];
+                    else {
+                        fail(line, "unknown camera setting '" + key + "'");
+                        return false;
+                    }
+                }
+                if (!ok) {
+                    fail(line, "camera setting '" + key + "' needs a number");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if (keyword == "material") {
+            std::string name, type;
+            double v[4];
+            shared_ptr<material> mat;
+            if (read_word(p, name) && read_word(p, type)) {
+                if (type == "lambertian" && read_numbers(p, v, 3))
+                    mat = make_shared<lambertian>(color(v[0], v[1], v[2]));
+                else if (type == "metal" && read_numbers(p, v, 4))
+                    mat = make_shared<metal>(color(v[0], v[1], v[2]), v[3]);
+                else if (type == "dielectric" && read_numbers(p, v, 1))
+                    mat = make_shared<dielectric>(v[0]);
+            }
+            if (!mat || !at_line_end(p)) {
+                fail(line, "malformed material statement");
+                return false;
+            }
+            materials[name] = mat;
+            return true;
+        }
+
+        fail(line, "unknown statement '" + keyword + "'");
+        return false;
+    }
+
+    bool parse_geometry(const chunk& c, hittable_list& objects) {
+        // Runs on worker threads; the material table is read-only by now.
+        const char* p = c.text.c_str();
+        size_t line = c.first_line;
+        std::string keyword, name;
+
+        while (*p) {
+            const char* line_end = std::strchr(p, '\n');
+            if (!line_end)
+                line_end = p + std::strlen(p);
+
+            if (read_word(p, keyword) && p <= line_end) {
+                double v[7];
+                bool moving = (keyword == "moving_sphere");
+                int count = moving ? 7 : 4;
+
+                if (keyword != "sphere" && !moving) {
+                    bool header = (keyword == "camera" || keyword == "material");
+                    fail(line, header ? "'" + keyword + "' must come before the first sphere"
+                                      : "unknown statement '" + keyword + "'");
+                    return false;
+                }
+                if (!read_numbers(p, v, count) || !read_word(p, name) || !at_line_end(p)) {
+                    fail(line, "malformed " + keyword + " statement");
+                    return false;
+                }
+
+                auto found = materials.find(name);
+                if (found == materials.end()) {
+                    fail(line, "unknown material '" + name + "'");
+                    return false;
+                }
+
+                if (moving)
+                    objects.add(make_shared<sphere>(point3(v[0], v[1], v[2]), point3(v[3], v[4], v[5]), v[6], found->second));
+                else
+                    objects.add(make_shared<sphere>(point3(v[0], v[1], v[2]), v[3], found->second));
+            }
+
+            p = *line_end ? line_end + 1 : line_end;
+            line++;
+        }
+        return true;
+    }
+};
+
+#endif /* SCENE_PARSER_H */
+
+// Note
+// 파일을 읽는 thread(reader)는 header (camera, material)만 직접 파싱하고, geometry는 줄 단위로 잘린 chunk로 worker에게 넘김.
+// worker는 chunk를 파싱하자마자 그 chunk의 bvh_node subtree까지 만들기 때문에, 파일 읽기/파싱/BVH 빌드가 동시에 진행됨.
+// Chunk subtrees are only as tight as the file's own ordering: generators that emit geometry in spatial order get the best top-level tree.
@@ -12,7 +12,7 @@
 
 #include "hittable.h"
 
-class sphere : public hittable {
+class sphere final : public hittable {
 public:
     // Stationary Sphere
     sphere(point3 _center, double _radius, shared_ptr<material> _material)
@@ -74,7 +74,7 @@ public:
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
-        rec.mat = mat;
+        rec.mat = mat.get();
         
         return true;
     }
@@ -0,0 +1,188 @@
+//
+//  sphere_set.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// 16 bytes: what a sphere really is.
+struct packed_sphere {
+    float center[3];
+    float radius;
+};
+
+// Moving spheres add their motion delta (center2 - center1); stationary ones pay nothing for it.
+struct packed_moving_sphere {
+    packed_sphere sphere;
+    float motion[3];
+};
+
+static_assert(sizeof(packed_sphere) == 16, "packed_sphere should stay at 16 bytes");
+static_assert(sizeof(packed_moving_sphere) == 28, "packed_moving_sphere should stay at 28 bytes");
+
+template <typename material_index>
+class basic_sphere_set {
+public:
+    // A primitive source for compressed_bvh: spheres are addressed by index and have no vtable, no material
+    // pointer and no cached box. Indices [0, stationary_count) are stationary spheres, the rest are moving.
+    // The material index is 16 or 32 bits depending on material_index.
+
+    uint32_t add_material(shared_ptr<material> mat) {
+        // A material whose index doesn't fit material_index is reported and the set marked as failed (see valid());
+        // spheres can't refer to it.
+        if (materials.size() > max_material)
+            fail("material " + std::to_string(materials.size()));
+        materials.push_back(mat);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    bool add(const point3& center, double radius, uint32_t material) {
+        // Returns false (and the set is no longer valid) when material doesn't fit material_index, instead of
+        // silently wrapping around to another material.
+        if (material > max_material)
+            return fail("sphere with material " + std::to_string(material));
+        stationary.push_back(pack(center, radius));
+        stationary_material.push_back(static_cast<material_index>(material));
+        return true;
+    }
+
+    bool add(const point3& center1, const point3& center2, double radius, uint32_t material) {
+        auto motion = center2 - center1;
+        if (motion.near_zero())
+            return add(center1, radius, material);
+        if (material > max_material)
+            return fail("sphere with material " + std::to_string(material));
+        packed_moving_sphere s;
+        s.sphere = pack(center1, radius);
+        for (int a = 0; a < 3; a++)
+            s.motion[a] = static_cast<float>(motion[a]);
+        moving.push_back(s);
+        moving_material.push_back(static_cast<material_index>(material));
+        return true;
+    }
+
+    bool valid() const { return !failed; }
+
+    size_t size() const { return stationary.size() + moving.size(); }
+
+    aabb bounds(size_t i) const {
+        // Computed on demand; only the BVH builder asks for it.
+        if (i < stationary.size())
+            return sphere_box(stationary[i], 0, 0, 0);
+        const auto& m = moving[i - stationary.size()];
+        return aabb(sphere_box(m.sphere, 0, 0, 0), sphere_box(m.sphere, m.motion[0], m.motion[1], m.motion[2]));
+    }
+
+    bool hit(size_t i, const ray& r, interval ray_t, hit_record& rec) const {
+        if (i < stationary.size()) {
+            if (!hit_sphere(stationary[i], point3(0,0,0), r, ray_t, rec))
+                return false;
+            rec.mat = materials[stationary_material[i]].get();
+            return true;
+        }
+
+        auto j = i - stationary.size();
+        const auto& m = moving[j];
+        auto offset = r.time() * vec3(m.motion[0], m.motion[1], m.motion[2]);
+        if (!hit_sphere(m.sphere, offset, r, ray_t, rec))
+            return false;
+        rec.mat = materials[moving_material[j]].get();
+        return true;
+    }
+
+    size_t memory_bytes() const {
+        // Geometry and material indices; the material objects themselves are shared and not counted.
+        return stationary.capacity() * sizeof(packed_sphere)
+             + moving.capacity() * sizeof(packed_moving_sphere)
+             + (stationary_material.capacity() + moving_material.capacity()) * sizeof(material_index);
+    }
+
+    void shrink_to_fit() {
+        stationary.shrink_to_fit();
+        moving.shrink_to_fit();
+        stationary_material.shrink_to_fit();
+        moving_material.shrink_to_fit();
+    }
+
+private:
+    std::vector<packed_sphere> stationary;
+    std::vector<packed_moving_sphere> moving;
+    std::vector<material_index> stationary_material;
+    std::vector<material_index> moving_material;
+    std::vector<shared_ptr<material>> materials;
+    bool failed = false;
+
+    static const uint32_t max_material = std::numeric_limits<material_index>::max();
+
+    bool fail(const std::string& what) {
+        std::clog << "sphere_set: " << what << " is past the " << (uint64_t(max_material) + 1)
+                  << " materials a " << 8 * sizeof(material_index) << "-bit material index can address.\n";
+        failed = true;
+        return false;
+    }
+
+    static packed_sphere pack(const point3& center, double radius) {
+        packed_sphere s;
+        for (int a = 0; a < 3; a++)
+            s.center[a] = static_cast<float>(center[a]);
+        s.radius = static_cast<float>(radius);
+        return s;
+    }
+
+    static aabb sphere_box(const packed_sphere& s, float dx, float dy, float dz) {
+        auto c = point3(s.center[0] + double(dx), s.center[1] + double(dy), s.center[2] + double(dz));
+        auto rvec = vec3(s.radius, s.radius, s.radius);
+        return aabb(c - rvec, c + rvec);
+    }
+
+    static bool hit_sphere(const packed_sphere& s, const vec3& offset, const ray& r, interval ray_t, hit_record& rec) {
+        // Same math as sphere::hit, in double: the floats are only the storage format.
+        point3 center = point3(s.center[0], s.center[1], s.center[2]) + offset;
+        double radius = s.radius;
+
+        vec3 oc = r.origin() - center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(oc, r.direction());
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = half_b*half_b - a*c;
+        if (discriminant < 0)   return false;
+        auto sqrtd = sqrt(discriminant);
+
+        auto root = (-half_b - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (-half_b + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        return true;
+    }
+};
+
+using sphere_set = basic_sphere_set<uint32_t>;
+using small_sphere_set = basic_sphere_set<uint16_t>;   // up to 65536 materials
+
+#endif /* SPHERE_SET_H */
+
+// Note
+// sphere class는 double center/center_vec/radius, is_moving, shared_ptr<material>, 캐시된 aabb, vtable pointer로 100 bytes를 훌쩍 넘음.
+// sphere_set은 stationary sphere를 16 bytes (float center + radius) + material index (2 or 4 bytes)로 저장하고,
+// moving spheres keep their 12-byte motion delta in a separate array, so only they pay for it.
@@ -0,0 +1,195 @@
+//
+//  tile_store.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Tiled image file (.rttiles) for images too large to hold in memory: each finished tile goes straight to disk,
+// and the output image is assembled from it afterwards a band of tiles at a time.
+// Header, then one fixed-size record per tile in row-major tile order: a record header (the tile's sample count,
+// 0 until the tile is done) and the tile's averaged linear radiance as float RGB, tile_size x tile_size pixels
+// (edge tiles use the top-left part). Records are 64-byte aligned and written with pwrite, so any thread can store
+// any tile at any time, and a render that is killed can skip the tiles that made it to disk.
+static const char tile_store_magic[8] = {'R','T','T','I','L','E','S','\0'};
+static const uint32_t tile_store_version = 1;
+
+struct tile_store_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;
+    uint32_t reserved;
+    uint64_t job_key;         // as for checkpoints: a tile file only resumes the same view
+    uint64_t record_offset;
+    uint64_t record_bytes;
+    uint64_t file_size;
+};
+
+struct tile_record_header {
+    uint32_t samples;         // samples per pixel of the stored tile; 0 = not rendered yet
+    uint32_t reserved[3];
+};
+
+class tile_store {
+public:
+    tile_store() {}
+    tile_store(const tile_store&) = delete;
+    tile_store& operator=(const tile_store&) = delete;
+
+    ~tile_store() { close(); }
+
+    bool open(const std::string& path, int width, int height, int tile_size, uint64_t job_key, bool resume) {
+        // Creates an empty tile file, or with resume reopens one for the same image and keeps its finished tiles
+        // (a missing file is created). The file is sparse: tiles take disk space as they are written.
+        close();
+        layout(width, height, tile_size, job_key);
+
+        if (resume) {
+            fd = ::open(path.c_str(), O_RDWR);
+            if (fd >= 0) {
+                tile_store_header existing;
+                if (read_at(0, &existing, sizeof(existing)) && std::memcmp(&existing, &header, sizeof(header)) == 0) {
+                    std::clog << "Resuming from " << path << ".\n";
+                    return true;
+                }
+                std::clog << "Tile file " << path << " belongs to a different render.\n";
+                close();
+                return false;
+            }
+        }
+
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(header.file_size)) != 0 || !write_at(0, &header, sizeof(header))) {
+            std::clog << "Cannot create tile file " << path << ".\n";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    int width() const { return header.width; }
+    int height() const { return header.height; }
+    int tile_size() const { return header.tile_size; }
+    int columns() const { return columns_; }
+    int bands() const { return bands_; }
+
+    image_tile tile(int index) const {
+        int size = header.tile_size;
+        int x0 = (index % columns_) * size;
+        int y0 = (index / columns_) * size;
+        return image_tile{x0, y0, std::min(x0 + size, width()), std::min(y0 + size, height())};
+    }
+
+    uint32_t samples(int index) const {
+        tile_record_header record;
+        return read_at(record_offset(index), &record, sizeof(record)) ? record.samples : 0;
+    }
+
+    bool write_tile(int index, const std::vector<float>& rgb, uint32_t samples) {
+        // rgb holds the tile's pixels row by row (x1 - x0 wide). The pixels are written before the record header,
+        // so a tile only counts as done once all of it is on disk. Safe to call from several threads.
+        auto t = tile(index);
+        size_t row_floats = static_cast<size_t>(t.x1 - t.x0) * 3;
+        std::vector<float> record(static_cast<size_t>(header.tile_size) * header.tile_size * 3, 0.0f);
+        for (int j = t.y0; j < t.y1; ++j)
+            std::memcpy(&record[static_cast<size_t>(j - t.y0) * header.tile_size * 3], &rgb[(j - t.y0) * row_floats],
+                        row_floats * sizeof(float));
+
+        tile_record_header done;
+        std::memset(&done, 0, sizeof(done));
+        done.samples = samples;
+        uint64_t offset = record_offset(index);
+        if (write_at(offset + sizeof(tile_record_header), record.data(), record.size() * sizeof(float))
+            && write_at(offset, &done, sizeof(done)))
+            return true;
+        std::clog << "Failed to store tile " << index << ".\n";
+        return false;
+    }
+
+    bool read_band(int band, framebuffer& rows) const {
+        // Loads the tiles of one band into rows (reset to width x band height) as one sample each.
+        // Tiles that were never rendered stay black.
+        auto first = tile(band * columns_);
+        rows.reset(width(), first.y1 - first.y0);
+        std::vector<float> record(static_cast<size_t>(header.tile_size) * header.tile_size * 3);
+        for (int c = 0; c < columns_; ++c) {
+            int index = band * columns_ + c;
+            auto t = tile(index);
+            if (samples(index) == 0)
+                continue;
+            if (!read_at(record_offset(index) + sizeof(tile_record_header), record.data(), record.size() * sizeof(float)))
+                return false;
+            for (int j = t.y0; j < t.y1; ++j) {
+                for (int i = t.x0; i < t.x1; ++i) {
+                    const float* p = &record[(static_cast<size_t>(j - t.y0) * header.tile_size + (i - t.x0)) * 3];
+                    rows.add(i, j - t.y0, color(p[0], p[1], p[2]), 1, 0.0);
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    int fd = -1;
+    tile_store_header header;
+    int columns_ = 0, bands_ = 0;
+
+    void layout(int width, int height, int tile_size, uint64_t job_key) {
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, tile_store_magic, sizeof(header.magic));
+        header.version = tile_store_version;
+        header.header_size = sizeof(tile_store_header);
+        header.width = static_cast<uint32_t>(width);
+        header.height = static_cast<uint32_t>(height);
+        header.tile_size = static_cast<uint32_t>(tile_size);
+        header.job_key = job_key;
+
+        auto align = [](uint64_t offset) { return (offset + 63) & ~uint64_t(63); };
+        columns_ = (width + tile_size - 1) / tile_size;
+        bands_ = (height + tile_size - 1) / tile_size;
+        header.record_offset = align(sizeof(tile_store_header));
+        header.record_bytes = align(sizeof(tile_record_header) + uint64_t(tile_size) * tile_size * 3 * sizeof(float));
+        header.file_size = header.record_offset + uint64_t(columns_) * bands_ * header.record_bytes;
+    }
+
+    uint64_t record_offset(int index) const { return header.record_offset + uint64_t(index) * header.record_bytes; }
+
+    bool read_at(uint64_t offset, void* data, size_t size) const {
+        return pread(fd, data, size, static_cast<off_t>(offset)) == static_cast<ssize_t>(size);
+    }
+
+    bool write_at(uint64_t offset, const void* data, size_t size) {
+        return pwrite(fd, data, size, static_cast<off_t>(offset)) == static_cast<ssize_t>(size);
+    }
+};
+
+#endif /* TILE_STORE_H */
+
+// Note
+// 기가픽셀 이미지는 framebuffer (pixel당 40 bytes) 전체를 메모리에 둘 수 없음.
+// 완성된 tile은 바로 파일에 쓰고, 메모리에는 thread마다 작업 중인 tile 하나와 조립할 때의 band 하나만 있음.
+// The output PNG/PFM is assembled from the file one band of tiles at a time, so memory grows with the image width only through that band.
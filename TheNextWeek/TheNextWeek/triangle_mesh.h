@@ -0,0 +1,134 @@
+//
+//  triangle_mesh.h
+//  TheNextWeek
+//
+//  Created by Sun on 2026/10/19.
+//
+
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+
+#include "compressed_bvh.h"
+#include "hittable.h"
+
+#include <cstdint>
+#include <vector>
+
+class mesh_data {
+public:
+    // Indexed triangle mesh with shared vertices. Positions are stored as three separate float arrays (SoA)
+    // and triangles as three vertex indices each: 12 bytes per vertex and 12 per triangle, no per-triangle objects.
+    std::vector<float> x, y, z;
+    std::vector<uint32_t> indices;
+    shared_ptr<material> mat;
+
+    size_t vertex_count() const { return x.size(); }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    uint32_t add_vertex(const point3& p) {
+        x.push_back(static_cast<float>(p.x()));
+        y.push_back(static_cast<float>(p.y()));
+        z.push_back(static_cast<float>(p.z()));
+        return static_cast<uint32_t>(x.size() - 1);
+    }
+
+    void add_triangle(uint32_t a, uint32_t b, uint32_t c) {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+
+    size_t memory_bytes() const {
+        return (x.capacity() + y.capacity() + z.capacity()) * sizeof(float) + indices.capacity() * sizeof(uint32_t);
+    }
+};
+
+class mesh_triangles {
+public:
+    // Primitive source for compressed_bvh: triangle i of a shared mesh_data.
+    mesh_triangles() {}
+    mesh_triangles(shared_ptr<const mesh_data> mesh) : data(mesh) {}
+
+    size_t size() const { return data ? data->triangle_count() : 0; }
+
+    aabb bounds(size_t i) const {
+        aabb box;
+        for (int k = 0; k < 3; k++) {
+            auto p = vertex(data->indices[3*i + k]);
+            box = aabb(box, aabb(p, p));
+        }
+        return box;
+    }
+
+    bool hit(size_t i, const ray& r, interval ray_t, hit_record& rec) const {
+        // Watertight ray/triangle test (Woop, Benthin and Wald 2013). The ray is sheared so it runs along +z,
+        // after which the test is three 2D edge functions. Edges shared by two triangles produce the same
+        // edge values with opposite signs, so a ray can't slip through the crack between them.
+        const auto& mesh = *data;
+        uint32_t i0 = mesh.indices[3*i], i1 = mesh.indices[3*i + 1], i2 = mesh.indices[3*i + 2];
+        const auto dir = r.direction();
+        const auto org = r.origin();
+
+        // Per-ray setup: dominant axis kz, the other two in winding-preserving order, and the shear.
+        int kz = 0;
+        if (fabs(dir[1]) > fabs(dir[kz])) kz = 1;
+        if (fabs(dir[2]) > fabs(dir[kz])) kz = 2;
+        int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+        if (dir[kz] < 0)
+            std::swap(kx, ky);
+        double sx = dir[kx] / dir[kz], sy = dir[ky] / dir[kz], sz = 1.0 / dir[kz];
+
+        // Vertices relative to the ray origin, gathered from the SoA arrays.
+        const float* axes[3] = { mesh.x.data(), mesh.y.data(), mesh.z.data() };
+        double ax = axes[kx][i0] - org[kx], ay = axes[ky][i0] - org[ky], az = axes[kz][i0] - org[kz];
+        double bx = axes[kx][i1] - org[kx], by = axes[ky][i1] - org[ky], bz = axes[kz][i1] - org[kz];
+        double cx = axes[kx][i2] - org[kx], cy = axes[ky][i2] - org[ky], cz = axes[kz][i2] - org[kz];
+
+        ax -= sx * az;  ay -= sy * az;
+        bx -= sx * bz;  by -= sy * bz;
+        cx -= sx * cz;  cy -= sy * cz;
+
+        double u = cx * by - cy * bx;
+        double v = ax * cy - ay * cx;
+        double w = bx * ay - by * ax;
+
+        // Mixed signs: the ray passes outside. Zeros are on an edge and count as inside for both neighbours.
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+
+        double det = u + v + w;
+        if (det == 0)
+            return false;
+
+        double t = (u * (sz * az) + v * (sz * bz) + w * (sz * cz)) / det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        auto p0 = vertex(i0), p1 = vertex(i1), p2 = vertex(i2);
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+        rec.mat = mesh.mat.get();
+        return true;
+    }
+
+private:
+    shared_ptr<const mesh_data> data;
+
+    point3 vertex(uint32_t v) const {
+        return point3(data->x[v], data->y[v], data->z[v]);
+    }
+};
+
+// A mesh with its own BVH, built by the same compressed_bvh builder used for sphere_set.
+// Several instances (see instance.h) can share one triangle_mesh.
+using triangle_mesh = compressed_bvh<mesh_triangles>;
+
+#endif /* TRIANGLE_MESH_H */
+
+// Note
+// mesh_data는 vertex와 index buffer만 가지고, triangle마다 shared_ptr나 hittable object를 만들지 않음.
+// 그래서 million-triangle mesh도 vertex당 12 bytes + triangle당 12 bytes + BVH (약 10 bytes/triangle) 정도로 표현됨.
+// Shading uses the geometric normal; OBJ vertex normals and texture coordinates are not kept.
@@ -11,6 +11,8 @@
 #include <cmath>
 #include <iostream>
 
+#include "sampling.h"
+
 using std::sqrt;
 using std::fabs;
 
@@ -121,27 +123,39 @@ inline vec3 unit_vector(vec3 v) {
 }
 
 inline vec3 random_in_unit_disk() {
-    // using the same kind of method in random_in_unit_sphere()
-    // just for "two dimensions".
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() < 1)
-            return p;
-    }
+    // 예전에는 random_in_unit_sphere()와 같은 rejection method를 "two dimensions"로 사용했음.
+    // Now the concentric disk mapping (sampling.h): always two random numbers, no loop.
+    double u1 = random_double(), u2 = random_double();
+    vec3 p;
+    sample_disk(u1, u2, p.e[0], p.e[1]);
+    return p;
 }
 
 inline vec3 random_in_unit_sphere() {
-    // use a rejection method to generate the random vector inside of the unit sphere.
-    // unit cube 안에서 랜덤한 지점을 pick하지만 unit sphere를 벗어난 범위의 point는 무시.
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() < 1)
-            return p;
-    }
+    // 예전에는 unit cube 안에서 랜덤한 지점을 pick하고 unit sphere를 벗어난 point는 무시하는 rejection method였음. (평균 1.9회 시도)
+    // Now a uniform direction scaled by cbrt(u): three random numbers, no loop.
+    double u1 = random_double(), u2 = random_double(), u3 = random_double();
+    vec3 p;
+    sample_ball(u1, u2, u3, p.e[0], p.e[1], p.e[2]);
+    return p;
 }
 
 inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+    // Sampled on the sphere directly, so there is no normalization (sqrt and divide) afterwards.
+    double u1 = random_double(), u2 = random_double();
+    vec3 p;
+    sample_sphere_surface(u1, u2, p.e[0], p.e[1], p.e[2]);
+    return p;
+}
+
+inline vec3 random_cosine_direction(const vec3& normal) {
+    // Cosine-weighted direction around a unit normal: a sample around +z rotated into the normal's frame.
+    double u1 = random_double(), u2 = random_double();
+    double x, y, z;
+    sample_cosine_hemisphere(u1, u2, x, y, z);
+    vec3 t, b;
+    orthonormal_basis(normal.e, t.e, b.e);
+    return x * t + y * b + z * normal;
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal) {